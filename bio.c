@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,6 +17,18 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Each buffer sits in the bucket of the block it holds, hashed on
+// (dev, blockno), on a list in most recently used order; the bucket's
+// lock protects the list and the refcnt of its buffers. Looking up a
+// cached block only takes its bucket's lock. Recycling a buffer for
+// another block moves it between buckets, and is serialized by
+// bcache.lock so that at most one process ever holds two bucket locks.
+//
+// bprefetch starts reading a block without waiting for it. The
+// buffer stays locked, marked B_ASYNC, until the disk driver has
+// filled it in and calls bdone; anyone who wants the block in the
+// meantime waits on the buffer's lock as usual.
 
 #include "types.h"
 #include "defs.h"
@@ -26,72 +38,170 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+// A committing transaction keeps up to LOGSIZE dirty blocks in the
+// cache and the log writer needs 2*LOGBATCH more; with fewer
+// buffers bget could run out and panic. The kernel, bcache
+// included, must also end within the 4MB that entrypgdir maps.
+#if NBUF < LOGSIZE + 2*LOGBATCH
+#error "NBUF is too small for the log"
+#endif
+#if NBUF > 2048
+#error "NBUF is too large for the boot page table"
+#endif
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;  // head.next is most recently used
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;  // serializes recycling
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Unlink b from its bucket's list.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Put b at the front of bk's list.
+static void
+bpush(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
 void
 binit(void)
 {
+  struct bucket *bk;
   struct buf *b;
 
   initlock(&bcache.lock, "bcache");
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+  }
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Spread the buffers over the buckets; they hold no block yet.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bpush(&bcache.bucket[(b - bcache.buf) % NBUCKET], b);
   }
 }
 
+// Look for block on device dev in bucket bk, which must be locked.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// For a prefetch, return 0 instead if the block is already
+// cached or no buffer is free.
 static struct buf*
-bget(uint dev, uint blockno)
+bget1(uint dev, uint blockno, int prefetch)
 {
+  struct bucket *bk, *home;
   struct buf *b;
+  int i;
 
-  acquire(&bcache.lock);
+  home = bhash(dev, blockno);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
+  acquire(&home->lock);
+  if((b = blookup(home, dev, blockno)) != 0 && !prefetch)
+    b->refcnt++;
+  release(&home->lock);
+  if(b){
+    if(prefetch)
+      return 0;
+    acquiresleep(&b->lock);
+    return b;
+  }
+
+  // Not cached; recycle an unused buffer. Look again once
+  // recycling is ours, in case someone else just did it for
+  // this block.
+  acquire(&bcache.lock);
+  acquire(&home->lock);
+  if((b = blookup(home, dev, blockno)) != 0){
+    if(!prefetch)
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+    release(&home->lock);
+    release(&bcache.lock);
+    if(prefetch)
+      return 0;
+    acquiresleep(&b->lock);
+    return b;
   }
 
-  // Not cached; recycle an unused buffer.
+  // Take the least recently used free buffer of the first
+  // bucket that has one, starting with the block's own.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  for(i = 0; i < NBUCKET; i++){
+    bk = &bcache.bucket[(home - bcache.bucket + i) % NBUCKET];
+    if(bk != home)
+      acquire(&bk->lock);
+    for(b = bk->head.prev; b != &bk->head; b = b->prev){
+      if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+        b->dev = dev;
+        b->blockno = blockno;
+        b->flags = 0;
+        b->refcnt = 1;
+        if(bk != home){
+          bunlink(b);
+          release(&bk->lock);
+          bpush(home, b);
+        }
+        release(&home->lock);
+        release(&bcache.lock);
+        acquiresleep(&b->lock);
+        return b;
+      }
     }
+    if(bk != home)
+      release(&bk->lock);
+  }
+  if(prefetch){
+    release(&home->lock);
+    release(&bcache.lock);
+    return 0;
   }
   panic("bget: no buffers");
 }
 
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  return bget1(dev, blockno, 0);
+}
+
 // Return a locked buf with the contents of the indicated block.
 struct buf*
 bread(uint dev, uint blockno)
@@ -105,6 +215,19 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Start reading the indicated block into the cache, if it
+// is not there already, without waiting for the disk.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget1(dev, blockno, 1)) == 0)
+    return;
+  b->flags |= B_ASYNC;
+  ideprefetch(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,8 +238,40 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Drop a reference to b, whose lock has been released.
+// Move to the head of its bucket's MRU list.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    bunlink(b);
+    bpush(bk, b);
+  }
+  release(&bk->lock);
+}
+
+// Write the contents of the n locked bufs in bs to disk,
+// all queued at once so the disk driver can merge and sort them.
+void
+bwritev(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwritev");
+    bs[i]->flags |= B_DIRTY;
+  }
+  iderwv(bs, n);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
 void
 brelse(struct buf *b)
 {
@@ -124,21 +279,17 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
-  release(&bcache.lock);
+// Release a read-ahead buffer once the disk has filled it in.
+// Called by the disk driver, maybe from an interrupt, on
+// behalf of whoever called bprefetch.
+void
+bdone(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bput(b);
 }
 //PAGEBREAK!
 // Blank page.
-
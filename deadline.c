@@ -0,0 +1,23 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// run a command as a deadline process
+int main(int argc, char **argv)
+{
+    if (argc < 4)
+    {
+        printf(2, "Wrong format for deadline; Usage deadline runtime period command [args]\n");
+        exit();
+    }
+
+    if (sched_deadline(atoi(argv[1]), atoi(argv[2])) < 0)
+    {
+        printf(2, "deadline: %s ticks every %s not admitted\n", argv[1], argv[2]);
+        exit();
+    }
+
+    if (exec(argv[3], argv + 3) < 0)
+        printf(2, "deadline: Unable to run command\n");
+    exit();
+}
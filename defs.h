@@ -4,9 +4,13 @@ struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct proc_queue;
+struct proc_heap;
+struct proc_rbtree;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
+struct timer;
 struct stat;
 struct superblock;
 
@@ -15,6 +19,9 @@ void binit(void);
 struct buf *bread(uint, uint);
 void brelse(struct buf *);
 void bwrite(struct buf *);
+void bwritev(struct buf **, int);
+void bprefetch(uint, uint);
+void bdone(struct buf *);
 
 // console.c
 void consoleinit(void);
@@ -33,6 +40,7 @@ void fileinit(void);
 int fileread(struct file *, char *, int n);
 int filestat(struct file *, struct stat *);
 int filewrite(struct file *, char *, int n);
+int filesplice(struct file *, struct file *, int n);
 
 // fs.c
 void readsb(int dev, struct superblock *sb);
@@ -40,6 +48,8 @@ int dirlink(struct inode *, char *, uint);
 struct inode *dirlookup(struct inode *, char *, uint *);
 struct inode *ialloc(uint, short);
 struct inode *idup(struct inode *);
+struct inode *iexecdup(struct inode *);
+void iexecput(struct inode *);
 void iinit(int dev);
 void ilock(struct inode *);
 void iput(struct inode *);
@@ -57,6 +67,8 @@ int writei(struct inode *, char *, uint, uint);
 void ideinit(void);
 void ideintr(void);
 void iderw(struct buf *);
+void iderwv(struct buf **, int);
+void ideprefetch(struct buf *);
 
 // ioapic.c
 void ioapicenable(int irq, int cpu);
@@ -66,6 +78,8 @@ void ioapicinit(void);
 // kalloc.c
 char *kalloc(void);
 void kfree(char *);
+void kdup(char *);
+int krefs(char *);
 void kinit1(void *, void *);
 void kinit2(void *, void *);
 
@@ -78,7 +92,9 @@ int lapicid(void);
 extern volatile uint *lapic;
 void lapiceoi(void);
 void lapicinit(void);
+void lapicipi(int, int);
 void lapicstartap(uchar, uint);
+void lapictimer(int);
 void microdelay(int);
 
 // log.c
@@ -86,6 +102,7 @@ void initlog(int dev);
 void log_write(struct buf *);
 void begin_op();
 void end_op();
+void log_sync(void);
 
 // mp.c
 extern int ismp;
@@ -100,6 +117,8 @@ int pipealloc(struct file **, struct file **);
 void pipeclose(struct pipe *, int);
 int piperead(struct pipe *, char *, int);
 int pipewrite(struct pipe *, char *, int);
+int pipesplicein(struct pipe *, struct file *, int);
+int pipespliceout(struct pipe *, struct file *, int);
 
 //PAGEBREAK: 16
 // proc.c
@@ -121,10 +140,24 @@ int wait(void);
 int waitx(int *, int *);
 void wakeup(void *);
 void yield(void);
-void upd_ptimes(void);
+void log_procs(void);
 int set_priority(int, int);
-void inc_cticks(struct proc *);
+int set_scheduler(int);
+int settickets(int, int);
+int sched_deadline(int, int);
 int ps(void);
+int kthread(char *, void (*)(void));
+
+// sched.c
+void sched_init(void);
+void push_process(struct proc *);
+void remove_process(struct proc *);
+int sched_runnable(struct cpu *);
+struct proc *sched_dequeue(struct cpu *);
+void sched_migrate(struct proc *, int);
+int sched_tick(struct proc *);
+void sched_release(void);
+int sched_setclass(int);
 
 // swtch.S
 void swtch(struct context **, struct context *);
@@ -156,13 +189,16 @@ char *strncpy(char *, const char *, int);
 // syscall.c
 int argint(int, int *);
 int argptr(int, char **, int);
+int argptrw(int, char **, int);
 int argstr(int, char **);
 int fetchint(uint, int *);
 int fetchstr(uint, char **);
 void syscall(void);
 
 // timer.c
-void timerinit(void);
+void timer_add(struct timer *);
+void timer_del(struct timer *);
+void timer_tick(void);
 
 // trap.c
 void idtinit(void);
@@ -189,13 +225,23 @@ pde_t *copyuvm(pde_t *, uint);
 void switchuvm(struct proc *);
 void switchkvm(void);
 int copyout(pde_t *, uint, void *, uint);
+int cowfault(pde_t *, uint);
+int pagefault(struct proc *, uint, uint);
+int prefaultuvm(struct proc *, uint, uint, int);
 void clearpteu(pde_t *pgdir, char *uva);
 
 // queue.c
-struct proc_node *q_alloc();
-void q_free();
-struct proc_node *push(struct proc_node *, struct proc *);
-struct proc_node *pop(struct proc_node *);
+void q_init(struct proc_queue *);
+void q_push(struct proc_queue *, struct proc *);
+struct proc *q_pop(struct proc_queue *);
+void q_remove(struct proc_queue *, struct proc *);
+void heap_init(struct proc_heap *, int (*)(struct proc *, struct proc *));
+void heap_push(struct proc_heap *, struct proc *);
+struct proc *heap_min(struct proc_heap *);
+void heap_remove(struct proc_heap *, struct proc *);
+void rb_init(struct proc_rbtree *, int (*)(struct proc *, struct proc *));
+void rb_insert(struct proc_rbtree *, struct proc *);
+void rb_remove(struct proc_rbtree *, struct proc *);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x) / sizeof((x)[0]))
@@ -14,8 +14,11 @@ exec(char *path, char **argv)
   int i, off;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *exe, *oldexe;
   struct proghdr ph;
+  struct execseg seg[NEXECSEG];
+  int nseg;
+  uint eend;
   pde_t *pgdir, *oldpgdir;
   struct proc *curproc = myproc();
 
@@ -28,6 +31,7 @@ exec(char *path, char **argv)
   }
   ilock(ip);
   pgdir = 0;
+  exe = 0;
 
   // Check ELF header
   if(readi(ip, (char*)&elf, 0, sizeof(elf)) != sizeof(elf))
@@ -38,8 +42,13 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the program segments; their pages are read in from
+  // ip when first touched (see pagefault in vm.c). Segments
+  // beyond NEXECSEG are loaded now, and must come in
+  // ascending order of address.
   sz = 0;
+  eend = 0;
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -47,15 +56,34 @@ exec(char *path, char **argv)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
-    if(ph.vaddr + ph.memsz < ph.vaddr)
-      goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz < ph.vaddr || ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
+    if(nseg < NEXECSEG){
+      seg[nseg].va = ph.vaddr;
+      seg[nseg].memsz = ph.memsz;
+      seg[nseg].off = ph.off;
+      seg[nseg].filesz = ph.filesz;
+      nseg++;
+      if(ph.vaddr + ph.memsz > sz)
+        sz = ph.vaddr + ph.memsz;
+      continue;
+    }
+    if(ph.vaddr < eend)
+      goto bad;
+    if(ph.memsz == 0)
+      continue;
+    if(allocuvm(pgdir, ph.vaddr, ph.vaddr + ph.memsz) == 0)
+      goto bad;
+    eend = ph.vaddr + ph.memsz;
+    if(eend > sz)
+      sz = eend;
     if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
       goto bad;
   }
+  if(nseg > 0)
+    exe = iexecdup(ip);
   iunlockput(ip);
   end_op();
   ip = 0;
@@ -95,12 +123,21 @@ exec(char *path, char **argv)
 
   // Commit to the user image.
   oldpgdir = curproc->pgdir;
+  oldexe = curproc->exe;
   curproc->pgdir = pgdir;
   curproc->sz = sz;
+  curproc->exe = exe;
+  curproc->nexecseg = nseg;
+  memmove(curproc->execseg, seg, sizeof(seg));
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
   freevm(oldpgdir);
+  if(oldexe){
+    begin_op();
+    iexecput(oldexe);
+    end_op();
+  }
   return 0;
 
  bad:
@@ -110,5 +147,10 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  if(exe){
+    begin_op();
+    iexecput(exe);
+    end_op();
+  }
   return -1;
 }
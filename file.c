@@ -126,11 +126,12 @@ filewrite(struct file *f, char *addr, int n)
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
     // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // i-node, two indirect blocks, the doubly-indirect
+    // block, allocation blocks, and 2 blocks of slop
+    // for non-aligned writes.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = ((MAXOPBLOCKS-1-2-1-2) / 2) * 512;
     int i = 0;
     while(i < n){
       int n1 = n - i;
@@ -155,3 +156,19 @@ filewrite(struct file *f, char *addr, int n)
   panic("filewrite");
 }
 
+// Move up to n bytes from file in to file out, one of which
+// must be a pipe, without copying them through user memory.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0 || n < 0)
+    return -1;
+  if(out->type == FD_PIPE){
+    if(in->type == FD_PIPE && in->pipe == out->pipe)
+      return -1;
+    return pipesplicein(out->pipe, in, n);
+  }
+  if(in->type == FD_PIPE)
+    return pipespliceout(in->pipe, out, n);
+  return -1;
+}
@@ -14,15 +14,21 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nexec;          // processes paging in from it (see iexecdup)
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint ra_next;       // block a sequential reader reads next
+  uint ra_end;        // first block past those read ahead
+  uint indidx;        // which indirect block ind holds, 0 if none (see bmap)
+  uint indaddr;       // its disk address
+  uint ind[NINDIRECT]; // copy of its block numbers
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
 };
 
 // table mapping major device number to
@@ -265,7 +265,11 @@ iget(uint dev, uint inum)
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
+  ip->nexec = 0;
   ip->valid = 0;
+  ip->ra_next = 0;
+  ip->ra_end = 0;
+  ip->indidx = 0;
   release(&icache.lock);
 
   return ip;
@@ -282,6 +286,32 @@ idup(struct inode *ip)
   return ip;
 }
 
+// Like idup, for a process that demand-pages its program from
+// ip (see exec). While any process does, writei refuses to
+// write ip, so that pages faulted in later match the ones
+// already loaded. Taking the first such reference requires ip
+// locked, which is how writei sees it.
+struct inode*
+iexecdup(struct inode *ip)
+{
+  acquire(&icache.lock);
+  ip->ref++;
+  ip->nexec++;
+  release(&icache.lock);
+  return ip;
+}
+
+// Drop a reference taken with iexecdup.
+// Must be called inside a transaction, as iput.
+void
+iexecput(struct inode *ip)
+{
+  acquire(&icache.lock);
+  ip->nexec--;
+  release(&icache.lock);
+  iput(ip);
+}
+
 // Lock the given inode.
 // Reads the inode from disk if necessary.
 void
@@ -365,14 +395,21 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT]. The last NDINDIRECT
+// are listed in the indirect blocks that are in turn listed
+// in the doubly-indirect block ip->addrs[NDIRECT+1].
+//
+// bmap keeps a copy of the last indirect block it used in
+// ip->ind, so that mapping a run of blocks reads it only once.
+// ip->indidx is 1 for the block at ip->addrs[NDIRECT], 2+i
+// for the i'th listed in the doubly-indirect block.
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
+  uint addr, idx, *a;
   struct buf *bp;
 
   if(bn < NDIRECT){
@@ -382,21 +419,69 @@ bmap(struct inode *ip, uint bn)
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+  if(bn < NINDIRECT)
+    idx = 1;
+  else if(bn - NINDIRECT < NDINDIRECT){
+    bn -= NINDIRECT;
+    idx = 2 + bn / NINDIRECT;
+    bn %= NINDIRECT;
+  } else
+    panic("bmap: out of range");
+
+  if(ip->indidx != idx){
+    // Find indirect block, allocating if necessary, and load it.
+    if(idx == 1){
+      if((addr = ip->addrs[NDIRECT]) == 0)
+        ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+    } else {
+      if((addr = ip->addrs[NDIRECT+1]) == 0)
+        ip->addrs[NDIRECT+1] = addr = balloc(ip->dev);
+      bp = bread(ip->dev, addr);
+      a = (uint*)bp->data;
+      if((addr = a[idx-2]) == 0){
+        a[idx-2] = addr = balloc(ip->dev);
+        log_write(bp);
+      }
+      brelse(bp);
+    }
     bp = bread(ip->dev, addr);
+    memmove(ip->ind, bp->data, sizeof(ip->ind));
+    brelse(bp);
+    ip->indidx = idx;
+    ip->indaddr = addr;
+  }
+
+  if((addr = ip->ind[bn]) == 0){
+    bp = bread(ip->dev, ip->indaddr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
+    a[bn] = ip->ind[bn] = addr = balloc(ip->dev);
+    log_write(bp);
     brelse(bp);
-    return addr;
   }
+  return addr;
+}
+
+// Free indirect block addr and the blocks it lists.
+// If depth is 2, addr is doubly indirect.
+static void
+ifree(uint dev, uint addr, int depth)
+{
+  struct buf *bp;
+  uint *a;
+  int j;
 
-  panic("bmap: out of range");
+  bp = bread(dev, addr);
+  a = (uint*)bp->data;
+  for(j = 0; j < NINDIRECT; j++){
+    if(a[j] == 0)
+      continue;
+    if(depth > 1)
+      ifree(dev, a[j], depth - 1);
+    else
+      bfree(dev, a[j]);
+  }
+  brelse(bp);
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -407,9 +492,7 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -419,18 +502,18 @@ itrunc(struct inode *ip)
   }
 
   if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
-    }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
+    ifree(ip->dev, ip->addrs[NDIRECT], 1);
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    ifree(ip->dev, ip->addrs[NDIRECT+1], 2);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
   ip->size = 0;
+  ip->ra_next = ip->ra_end = 0;
+  ip->indidx = 0;
   iupdate(ip);
 }
 
@@ -446,6 +529,33 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Called by readi before it reads block bn of ip. If ip is
+// being read sequentially, start reading the blocks up to
+// NREADAHEAD past bn, so that they are in the cache by the
+// time the reader gets to them.
+static void
+readahead(struct inode *ip, uint bn)
+{
+  uint b, end;
+
+  if(bn + 1 == ip->ra_next)
+    return;  // another read of the same block
+  if(bn != ip->ra_next){
+    // random access: start over
+    ip->ra_next = ip->ra_end = bn + 1;
+    return;
+  }
+  ip->ra_next = bn + 1;
+
+  end = bn + 1 + NREADAHEAD;
+  if(end > (ip->size + BSIZE - 1) / BSIZE)
+    end = (ip->size + BSIZE - 1) / BSIZE;
+  for(b = bn + 1 > ip->ra_end ? bn + 1 : ip->ra_end; b < end; b++)
+    bprefetch(ip->dev, bmap(ip, b));
+  if(end > ip->ra_end)
+    ip->ra_end = end;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
@@ -467,6 +577,7 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    readahead(ip, off/BSIZE);
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
@@ -490,6 +601,8 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return devsw[ip->major].write(ip, src, n);
   }
 
+  if(ip->nexec > 0)
+    return -1;
   if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
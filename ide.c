@@ -1,4 +1,5 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code. Uses PCI bus-master DMA when the
+// controller can, and programmed I/O otherwise.
 
 #include "types.h"
 #include "defs.h"
@@ -23,13 +24,50 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+// Bus-master registers of the primary channel, at the I/O
+// base in BAR4 of a PCI IDE controller such as the PIIX.
+#define BM_CMD        0
+#define BM_STATUS     2
+#define BM_PRDT       4
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // from the disk into memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+// Most sectors moved by one disk command.
+#define IDE_MAXSECT   64
 
 // idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+// A disk command covers the first idenbuf bufs on the queue,
+// consecutive blocks all read or all written; idesect sectors of
+// the first have been moved so far. The rest of the queue waits
+// in elevator (C-SCAN) order: up the disk from idepos, where the
+// running command ends, then from the lowest block up again.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idenbuf;
+static int idesect;
+static uint idepos;
+
+// Physical region descriptor: a piece of memory the
+// controller reads or writes during a DMA command.
+struct prd {
+  uint addr;     // physical address
+  ushort count;  // bytes
+  ushort flags;
+};
+#define PRD_EOT 0x8000  // last entry of the table
+
+// A buf's data may straddle a 64K boundary, which no entry can,
+// so a command takes up to two entries per buf. The table itself
+// must not straddle one either.
+static struct prd prdt[2*IDE_MAXSECT] __attribute__((aligned(2*IDE_MAXSECT*sizeof(struct prd))));
+static int idebm;  // I/O base of the bus-master registers, 0 for PIO
 
 static int havedisk1;
 static void idestart(struct buf*);
@@ -47,6 +85,52 @@ idewait(int checkerr)
   return 0;
 }
 
+static uint
+pciread(int dev, int fn, int reg)
+{
+  outl(0xcf8, 0x80000000 | (dev<<11) | (fn<<8) | reg);
+  return inl(0xcfc);
+}
+
+static void
+pciwrite(int dev, int fn, int reg, uint v)
+{
+  outl(0xcf8, 0x80000000 | (dev<<11) | (fn<<8) | reg);
+  outl(0xcfc, v);
+}
+
+// Look on PCI bus 0 for an IDE controller in legacy mode
+// that can do bus-master DMA, and turn DMA on.
+// Return the I/O base of its bus-master registers, or 0.
+static int
+idedmainit(void)
+{
+  int dev, fn;
+  uint class, bar;
+
+#ifdef IDEPIO
+  return 0;
+#endif
+  for(dev = 0; dev < 32; dev++){
+    for(fn = 0; fn < 8; fn++){
+      if((pciread(dev, fn, 0x00) & 0xffff) == 0xffff)
+        continue;
+      // class: storage, subclass: IDE, interface: bus master,
+      // primary channel at the legacy ports
+      class = pciread(dev, fn, 0x08);
+      if((class >> 16) != 0x0101 || (class & 0x8100) != 0x8000)
+        continue;
+      bar = pciread(dev, fn, 0x20);
+      if((bar & 1) == 0 || (bar & ~3) == 0)
+        continue;
+      // enable I/O space and bus mastering
+      pciwrite(dev, fn, 0x04, (pciread(dev, fn, 0x04) & 0xffff) | 0x5);
+      return bar & 0xfffc;
+    }
+  }
+  return 0;
+}
+
 void
 ideinit(void)
 {
@@ -67,43 +151,116 @@ ideinit(void)
 
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  idebm = idedmainit();
+}
+
+// Position of b's block in the elevator's sweep.
+static uint
+idekey(struct buf *b)
+{
+  return b->dev*FSSIZE + b->blockno;
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Add the n bytes at physical address pa to prdt from entry i,
+// never crossing a 64K boundary. Return the next free entry.
+static int
+prdadd(int i, uint pa, uint n)
+{
+  uint m;
+
+  for(; n > 0; n -= m, pa += m, i++){
+    m = 0x10000 - (pa & 0xffff);
+    if(m > n)
+      m = n;
+    prdt[i].addr = pa;
+    prdt[i].count = m;
+    prdt[i].flags = 0;
+  }
+  return i;
+}
+
+// Start the request for b, and for as many of the bufs queued
+// after it as continue b's run of blocks.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *q;
+  int i, n;
+
   if(b == 0)
     panic("idestart");
   if(b->blockno >= FSSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   if (sector_per_block > 7) panic("idestart");
 
+  idenbuf = 1;
+  for(q = b; q->qnext && (idenbuf+1)*sector_per_block <= IDE_MAXSECT; q = q->qnext){
+    if(q->qnext->dev != b->dev || q->qnext->blockno != q->blockno + 1 ||
+       (q->qnext->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+    idenbuf++;
+  }
+  idesect = 0;
+  idepos = idekey(q) + 1;
+
+  if(idebm){
+    // Point the controller at the bufs' data.
+    n = 0;
+    for(i = 0, q = b; i < idenbuf; i++, q = q->qnext)
+      n = prdadd(n, V2P(q->data), BSIZE);
+    prdt[n-1].flags = PRD_EOT;
+    outl(idebm+BM_PRDT, V2P(prdt));
+    outb(idebm+BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+    outb(idebm+BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+  }
+
+  // Plain READ/WRITE SECTORS: the drive interrupts once per sector.
+  // With DMA, once when the whole command is done.
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, idenbuf*sector_per_block);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
-    outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+  if(idebm){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm+BM_CMD, inb(idebm+BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
+    outb(0x1f7, IDE_CMD_WRITE);
+    outsl(0x1f0, b->data, SECTOR_SIZE/4);
   } else {
-    outb(0x1f7, read_cmd);
+    outb(0x1f7, IDE_CMD_READ);
   }
 }
 
+// Finish the request for b, which has left idequeue.
+// Caller must hold idelock.
+static void
+idedone(struct buf *b)
+{
+  // Wake process waiting for this buf. No one waits for a
+  // read-ahead; release the buffer for the process that started it.
+  b->flags |= B_VALID;
+  b->flags &= ~B_DIRTY;
+  if(b->flags & B_ASYNC){
+    b->flags &= ~B_ASYNC;
+    bdone(b);
+  } else
+    wakeup(b);
+}
+
 // Interrupt handler.
 void
 ideintr(void)
 {
   struct buf *b;
+  int st;
 
   // First queued buffer is the active request.
   acquire(&idelock);
@@ -112,16 +269,45 @@ ideintr(void)
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(idebm){
+    // The whole command is done.
+    st = inb(idebm+BM_STATUS);
+    outb(idebm+BM_CMD, 0);
+    outb(idebm+BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+    if((st & BM_ST_ERR) || idewait(1) < 0){
+      cprintf("ide: dma failed, using pio\n");
+      idebm = 0;
+      idestart(b);
+      release(&idelock);
+      return;
+    }
+    for(; idenbuf > 0; idenbuf--){
+      idequeue = b->qnext;
+      idedone(b);
+      b = idequeue;
+    }
+  } else {
+    // Read data if needed; one sector per interrupt.
+    if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+      insl(0x1f0, b->data + idesect*SECTOR_SIZE, SECTOR_SIZE/4);
+
+    if(++idesect == BSIZE/SECTOR_SIZE){
+      idequeue = b->qnext;
+      idenbuf--;
+      idesect = 0;
+      idedone(b);
+      b = idequeue;
+    }
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Go on with the running command.
+    if(idenbuf > 0){
+      if(b->flags & B_DIRTY)
+        outsl(0x1f0, b->data + idesect*SECTOR_SIZE, SECTOR_SIZE/4);
+      release(&idelock);
+      return;
+    }
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
@@ -130,14 +316,23 @@ ideintr(void)
   release(&idelock);
 }
 
+// Does a go before b in a sweep of the elevator from idepos?
+static int
+idebefore(struct buf *a, struct buf *b)
+{
+  if((idekey(a) >= idepos) != (idekey(b) >= idepos))
+    return idekey(a) >= idepos;
+  return idekey(a) < idekey(b);
+}
+
 //PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
-void
-iderw(struct buf *b)
+// Queue b in elevator order. Caller must hold idelock,
+// and start the disk if it is idle.
+static void
+idequeue_add(struct buf *b)
 {
   struct buf **pp;
+  int i;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -146,23 +341,59 @@ iderw(struct buf *b)
   if(b->dev != 0 && !havedisk1)
     panic("iderw: ide disk 1 not present");
 
-  acquire(&idelock);  //DOC:acquire-lock
-
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+  // Skip the running command, then find b's place in the sweep.
+  pp = &idequeue;
+  for(i = 0; i < idenbuf; i++)
+    pp = &(*pp)->qnext;
+  for(; *pp && idebefore(*pp, b); pp=&(*pp)->qnext)  //DOC:insert-queue
     ;
+  b->qnext = *pp;
   *pp = b;
+}
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  iderwv(&b, 1);
+}
+
+// Sync the n bufs in bs with disk, queueing all of them
+// before starting the disk so that their blocks can merge.
+void
+iderwv(struct buf **bs, int n)
+{
+  int i;
+
+  acquire(&idelock);  //DOC:acquire-lock
+
+  for(i = 0; i < n; i++)
+    idequeue_add(bs[i]);
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idenbuf == 0)
+    idestart(idequeue);
 
-  // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
-    sleep(b, &idelock);
+  // Wait for requests to finish.
+  for(i = 0; i < n; i++){
+    while((bs[i]->flags & (B_VALID|B_DIRTY)) != B_VALID){
+      sleep(bs[i], &idelock);
+    }
   }
 
+  release(&idelock);
+}
 
+// Start reading b, marked B_ASYNC, and return at once.
+// ideintr hands b to bdone when the read is done.
+void
+ideprefetch(struct buf *b)
+{
+  acquire(&idelock);
+  idequeue_add(b);
+  if(idenbuf == 0)
+    idestart(idequeue);
   release(&idelock);
 }
@@ -23,6 +23,23 @@ struct {
   struct run *freelist;
 } kmem;
 
+// Once kmem.use_lock is set, each cpu allocates from and frees to its
+// own cache of up to KCACHE pages, touched only with interrupts off,
+// and goes to kmem a batch of KBATCH pages at a time. At most
+// KCACHE pages per cpu can be held back from other cpus.
+#define KCACHE 32
+#define KBATCH 16
+
+struct kcache {
+  struct run *freelist;
+  int n;
+} kcache[NCPU];
+
+// Number of references to each physical page, so that pages
+// shared copy-on-write after fork are freed by their last user.
+// Updated atomically, without kmem.lock.
+ushort pgref[PHYSTOP / PGSIZE];
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
@@ -48,32 +65,61 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    pgref[V2P(p) / PGSIZE] = 1;
     kfree(p);
+  }
 }
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, and free it if that was the last one. The page
+// normally should have been returned by a call to kalloc().
+// (The exception is when initializing the allocator; see
+// kinit above.)
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *c;
+  int i;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(pgref[V2P(v) / PGSIZE] == 0)
+    panic("kfree: free page");
+  if(__sync_sub_and_fetch(&pgref[V2P(v) / PGSIZE], 1) != 0)
+    return;
+
+#ifndef RELEASE
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
+  if(!kmem.use_lock){
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    return;
+  }
+
+  pushcli();
+  c = &kcache[cpuid()];
+  r->next = c->freelist;
+  c->freelist = r;
+  if(++c->n > KCACHE){
+    // give a batch back to the other cpus
+    acquire(&kmem.lock);
+    for(i = 0; i < KBATCH; i++){
+      r = c->freelist;
+      c->freelist = r->next;
+      r->next = kmem.freelist;
+      kmem.freelist = r;
+    }
     release(&kmem.lock);
+    c->n -= KBATCH;
+  }
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +129,53 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *c;
+
+  if(!kmem.use_lock){
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      pgref[V2P(r) / PGSIZE] = 1;
+    }
+    return (char*)r;
+  }
 
-  if(kmem.use_lock)
+  pushcli();
+  c = &kcache[cpuid()];
+  if(c->n == 0){
+    // refill with a batch from kmem
     acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
+    while(c->n < KBATCH && (r = kmem.freelist) != 0){
+      kmem.freelist = r->next;
+      r->next = c->freelist;
+      c->freelist = r;
+      c->n++;
+    }
     release(&kmem.lock);
+  }
+  r = c->freelist;
+  if(r){
+    c->freelist = r->next;
+    c->n--;
+  }
+  popcli();
+  if(r)
+    pgref[V2P(r) / PGSIZE] = 1;
   return (char*)r;
 }
 
+// Add a reference to the page pointed at by v, which
+// must have been returned by kalloc().
+void
+kdup(char *v)
+{
+  __sync_add_and_fetch(&pgref[V2P(v) / PGSIZE], 1);
+}
+
+// Number of references to the page pointed at by v.
+int
+krefs(char *v)
+{
+  return pgref[V2P(v) / PGSIZE];
+}
+
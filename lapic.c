@@ -113,6 +113,27 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Mask (on == 0) or unmask this cpu's timer interrupt.
+void
+lapictimer(int on)
+{
+  if(!lapic)
+    return;
+  lapicw(TIMER, (on ? 0 : MASKED) | PERIODIC | (T_IRQ0 + IRQ_TIMER));
+}
+
+// Send interrupt vector to the cpu with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
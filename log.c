@@ -5,6 +5,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "timer.h"
 
 // Simple logging that allows concurrent FS system calls.
 //
@@ -18,7 +19,15 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the log writer has committed.
+//
+// Commits are done by the log writer, a kernel thread, not
+// by the system calls. Once no system call is in the
+// transaction it waits LOGDELAY ticks for more to join, so
+// that a burst of them share one commit, unless someone is
+// waiting for it. end_op() returns without waiting for the
+// commit; log_sync() waits until everything before it is
+// safely in the log, but not until it is installed.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -27,7 +36,11 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous. The log's size is set by mkfs
+// and read from the superblock; it holds at most LOGSIZE blocks.
+// Blocks are written LOGBATCH at a time, so that the disk
+// driver can merge the log writes into a few large ones and
+// sort the installs.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,13 +55,16 @@ struct log {
   int size;
   int outstanding; // how many FS sys calls are executing.
   int committing;  // in commit(), please wait.
+  int hurry;       // someone is waiting for the next commit.
+  uint trans;      // number of the transaction being built.
+  uint committed;  // last transaction whose header is on disk.
   int dev;
   struct logheader lh;
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void logwriter(void);
 
 void
 initlog(int dev)
@@ -61,23 +77,37 @@ initlog(int dev)
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  if(log.size > LOGSIZE+1)
+    log.size = LOGSIZE+1;
+  if(log.size < MAXOPBLOCKS+1)
+    panic("initlog: log too small");
   log.dev = dev;
+  log.trans = 1;
   recover_from_log();
+  if(kthread("logwriter", logwriter) < 0)
+    panic("initlog: no log writer");
 }
 
 // Copy committed blocks from log to their home location
 static void
 install_trans(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+  struct buf *dbuf[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > LOGBATCH)
+      n = LOGBATCH;
+    for (i = 0; i < n; i++) {
+      struct buf *lbuf = bread(log.dev, log.start+tail+i+1); // read log block
+      dbuf[i] = bread(log.dev, log.lh.block[tail+i]); // read dst
+      memmove(dbuf[i]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    bwritev(dbuf, n);  // write dsts to disk
+    for (i = 0; i < n; i++)
+      brelse(dbuf[i]);
   }
 }
 
@@ -129,8 +159,10 @@ begin_op(void)
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.size-1){
       // this op might exhaust log space; wait for commit.
+      log.hurry = 1;
+      wakeup(&log.trans);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
@@ -141,69 +173,132 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// lets the log writer commit if this was the last
+// outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
   if(log.committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  if(log.outstanding == 0)
+    wakeup(&log.trans);
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Wait until the transactions of all FS system calls
+// that have ended are committed.
+void
+log_sync(void)
+{
+  uint trans;
+
+  acquire(&log.lock);
+  if(log.lh.n > 0 || log.committing){
+    trans = log.trans;
+    log.hurry = 1;
+    wakeup(&log.trans);
+    while(log.committed < trans)
+      sleep(&log, &log.lock);
   }
+  release(&log.lock);
 }
 
 // Copy modified blocks from cache to log.
 static void
 write_log(void)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  struct buf *to[LOGBATCH];
+  int tail, i, n;
+
+  for (tail = 0; tail < log.lh.n; tail += n) {
+    n = log.lh.n - tail;
+    if (n > LOGBATCH)
+      n = LOGBATCH;
+    for (i = 0; i < n; i++) {
+      to[i] = bread(log.dev, log.start+tail+i+1); // log block
+      struct buf *from = bread(log.dev, log.lh.block[tail+i]); // cache block
+      memmove(to[i]->data, from->data, BSIZE);
+      brelse(from);
+    }
+    bwritev(to, n);  // write the log
+    for (i = 0; i < n; i++)
+      brelse(to[i]);
   }
 }
 
+// Called from the timer interrupt LOGDELAY ticks
+// after the log writer started waiting.
+static void
+logtimeout(void *arg)
+{
+  acquire(&log.lock);
+  log.hurry = 1;
+  wakeup(&log.trans);
+  release(&log.lock);
+}
+
+// The log writer: commits transactions as they become ready.
 static void
-commit()
+logwriter(void)
 {
-  if (log.lh.n > 0) {
+  struct timer t;
+
+  t.fn = logtimeout;
+  t.arg = 0;
+  t.pending = 0;
+  for(;;){
+    // Wait for a transaction no system call is still in.
+    acquire(&log.lock);
+    while(log.lh.n == 0 || log.outstanding > 0)
+      sleep(&log.trans, &log.lock);
+    release(&log.lock);
+
+    // Give more system calls a chance to join it.
+    acquire(&tickslock);
+    t.expires = ticks + LOGDELAY;
+    timer_add(&t);
+    release(&tickslock);
+
+    acquire(&log.lock);
+    while(!log.hurry || log.outstanding > 0)
+      sleep(&log.trans, &log.lock);
+    log.hurry = 0;
+    log.committing = 1;
+    release(&log.lock);
+
+    acquire(&tickslock);
+    timer_del(&t);
+    release(&tickslock);
+
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
+
+    acquire(&log.lock);
+    log.committed = log.trans;
+    wakeup(&log);
+    release(&log.lock);
+
     install_trans(); // Now install writes to home locations
     log.lh.n = 0;
     write_head();    // Erase the transaction from the log
+
+    acquire(&log.lock);
+    log.trans++;
+    log.committing = 0;
+    wakeup(&log);
+    release(&log.lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// The log writer's write_log() will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -58,3 +58,23 @@ iderw(struct buf *b)
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
 }
+
+// Sync the n bufs in bs with disk, one at a time.
+void
+iderwv(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    iderw(bs[i]);
+}
+
+// Read b, marked B_ASYNC, and release it: the
+// memory disk has no reason to read ahead.
+void
+ideprefetch(struct buf *b)
+{
+  b->flags &= ~B_ASYNC;
+  iderw(b);
+  bdone(b);
+}
@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = NLOG;
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -76,8 +76,17 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  if(argc > 3 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    argc -= 2;
+    argv += 2;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l nlog] fs.img files...\n");
+    exit(1);
+  }
+  if(nlog < MAXOPBLOCKS+1 || nlog > LOGSIZE+1){
+    fprintf(stderr, "mkfs: log must have %d to %d blocks\n", MAXOPBLOCKS+1, LOGSIZE+1);
     exit(1);
   }
 
@@ -259,8 +268,8 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  uint indirect[NINDIRECT], dindirect[NINDIRECT];
+  uint i, x, *ind;
 
   rinode(inum, &din);
   off = xint(din.size);
@@ -274,15 +283,32 @@ iappend(uint inum, void *xp, int n)
       }
       x = xint(din.addrs[fbn]);
     } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
+      if(fbn < NDIRECT + NINDIRECT){
+        ind = &din.addrs[NDIRECT];
+        i = fbn - NDIRECT;
+      } else {
+        // find the indirect block in the doubly-indirect one
+        if(xint(din.addrs[NDIRECT+1]) == 0){
+          din.addrs[NDIRECT+1] = xint(freeblock++);
+        }
+        rsect(xint(din.addrs[NDIRECT+1]), (char*)dindirect);
+        i = (fbn - NDIRECT - NINDIRECT) / NINDIRECT;
+        if(dindirect[i] == 0){
+          dindirect[i] = xint(freeblock++);
+          wsect(xint(din.addrs[NDIRECT+1]), (char*)dindirect);
+        }
+        ind = &dindirect[i];
+        i = (fbn - NDIRECT - NINDIRECT) % NINDIRECT;
+      }
+      if(xint(*ind) == 0){
+        *ind = xint(freeblock++);
       }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
+      rsect(xint(*ind), (char*)indirect);
+      if(indirect[i] == 0){
+        indirect[i] = xint(freeblock++);
+        wsect(xint(*ind), (char*)indirect);
       }
-      x = xint(indirect[fbn-NDIRECT]);
+      x = xint(indirect[i]);
     }
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
@@ -7,8 +7,19 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define NEXECSEG      4  // max demand-loaded segments per executable
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      126  // max data blocks in on-disk log, as many as the header holds
+#define NLOG         (MAXOPBLOCKS*6+1)  // blocks in the log mkfs makes, header included
+#define LOGDELAY     3  // ticks the log writer waits for more system calls
+#define LOGBATCH     32  // log blocks written or installed at once
+#ifndef NBUF
+#define NBUF         256  // size of disk block cache
+#endif
+#define NBUCKET      31  // hash buckets in the disk block cache
+#define NREADAHEAD   8  // blocks read ahead of a sequential reader
+#ifndef PIPEPAGES
+#define PIPEPAGES    4  // pages in a pipe's buffer, a power of two
+#endif
+#define FSSIZE       20000  // size of file system in blocks
 
@@ -8,21 +8,57 @@
 #include "sleeplock.h"
 #include "file.h"
 
-#define PIPESIZE 512
+// The ring buffer is PIPEPAGES pages, not necessarily next to
+// each other in memory, so a copy in or out stops at the end of
+// a page. PIPESIZE must divide 2^32 for nread and nwrite to wrap.
+#if PIPEPAGES < 1 || (PIPEPAGES & (PIPEPAGES-1))
+#error "PIPEPAGES must be a power of two"
+#endif
+#define PIPESIZE (PIPEPAGES*PGSIZE)
+
+// A reader that has emptied the pipe is woken by the next write.
+// A writer that has filled it is woken only once readers have
+// made room for at least PIPEWAKE more bytes, rather than for
+// every read.
+#define PIPEWAKE (PIPESIZE/2)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *data[PIPEPAGES];
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rwait;      // a reader is sleeping on nread
+  int wwait;      // a writer is sleeping on nwrite
+  int rbusy;      // splice is moving bytes out from nread
+  int wbusy;      // splice is moving bytes in at nwrite
 };
 
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++)
+    if(p->data[i])
+      kfree(p->data[i]);
+  kfree((char*)p);
+}
+
+// Address of byte i of p's ring buffer.
+static char*
+pipeaddr(struct pipe *p, uint i)
+{
+  i %= PIPESIZE;
+  return p->data[i / PGSIZE] + i % PGSIZE;
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *p;
+  int i;
 
   p = 0;
   *f0 = *f1 = 0;
@@ -30,10 +66,18 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p->data, 0, sizeof(p->data));
+  for(i = 0; i < PIPEPAGES; i++)
+    if((p->data[i] = kalloc()) == 0)
+      goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
   p->nread = 0;
+  p->rwait = 0;
+  p->wwait = 0;
+  p->rbusy = 0;
+  p->wbusy = 0;
   initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -48,7 +92,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -69,7 +113,7 @@ pipeclose(struct pipe *p, int writable)
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
@@ -78,21 +122,34 @@ pipeclose(struct pipe *p, int writable)
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
+  for(i = 0; i < n; i += m){
+    while(p->nwrite == p->nread + PIPESIZE || p->wbusy){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
+      if(p->rwait && !p->wbusy){
+        p->rwait = 0;
+        wakeup(&p->nread);
+      }
+      p->wwait = 1;
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = n - i;
+    if(m > p->nread + PIPESIZE - p->nwrite)
+      m = p->nread + PIPESIZE - p->nwrite;
+    if(m > PGSIZE - p->nwrite % PGSIZE)
+      m = PGSIZE - p->nwrite % PGSIZE;
+    memmove(pipeaddr(p, p->nwrite), addr + i, m);
+    p->nwrite += m;
+  }
+  if(p->rwait){
+    p->rwait = 0;
+    wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
@@ -100,22 +157,210 @@ pipewrite(struct pipe *p, char *addr, int n)
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+  while(p->rbusy || (p->nread == p->nwrite && p->writeopen)){  //DOC: pipe-empty
     if(myproc()->killed){
       release(&p->lock);
       return -1;
     }
+    p->rwait = 1;
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
-      break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    m = n - i;
+    if(m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    if(m > PGSIZE - p->nread % PGSIZE)
+      m = PGSIZE - p->nread % PGSIZE;
+    memmove(addr + i, pipeaddr(p, p->nread), m);
+    p->nread += m;
+  }
+  if(p->wwait && p->nread + PIPESIZE - p->nwrite >= PIPEWAKE){
+    p->wwait = 0;
+    wakeup(&p->nwrite);  //DOC: piperead-wakeup
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
   return i;
 }
+
+//PAGEBREAK: 40
+// Wait, like piperead, until q has bytes to read or its
+// writer has closed. Returns 1 if there are bytes, 0 at the
+// end of the pipe, -1 if killed.
+static int
+pipewaitdata(struct pipe *q)
+{
+  int r;
+
+  acquire(&q->lock);
+  while(q->rbusy || (q->nread == q->nwrite && q->writeopen)){
+    if(myproc()->killed){
+      release(&q->lock);
+      return -1;
+    }
+    q->rwait = 1;
+    sleep(&q->nread, &q->lock);
+  }
+  r = q->nread != q->nwrite;
+  release(&q->lock);
+  return r;
+}
+
+// Read up to n bytes of q into addr without waiting.
+// Returns the number read, 0 if q is empty or busy.
+static int
+pipetake(struct pipe *q, char *addr, int n)
+{
+  int i, m;
+
+  acquire(&q->lock);
+  for(i = 0; !q->rbusy && i < n && q->nread != q->nwrite; i += m){
+    m = n - i;
+    if(m > q->nwrite - q->nread)
+      m = q->nwrite - q->nread;
+    if(m > PGSIZE - q->nread % PGSIZE)
+      m = PGSIZE - q->nread % PGSIZE;
+    memmove(addr + i, pipeaddr(q, q->nread), m);
+    q->nread += m;
+  }
+  if(q->wwait && q->nread + PIPESIZE - q->nwrite >= PIPEWAKE){
+    q->wwait = 0;
+    wakeup(&q->nwrite);
+  }
+  release(&q->lock);
+  return i;
+}
+
+// Splice: move up to n bytes from f into p. f reads straight
+// into p's buffer, so the bytes are never copied through user
+// memory. The span being filled is reserved with wbusy, so
+// that p->lock need not be held while f reads. A pipe f is
+// read at most once, like piperead, and only after waiting
+// for it to have bytes: the reservation is held just for the
+// copy, so p's other writers (perhaps a splice the other way)
+// are never kept waiting on f.
+int
+pipesplicein(struct pipe *p, struct file *f, int n)
+{
+  int i, m, r;
+  uint off;
+
+  for(i = 0; i < n; i += r){
+    if(f->type == FD_PIPE && (r = pipewaitdata(f->pipe)) <= 0)
+      return i > 0 ? i : r;
+    acquire(&p->lock);
+    while(p->nwrite == p->nread + PIPESIZE || p->wbusy){
+      if(p->readopen == 0 || myproc()->killed){
+        release(&p->lock);
+        return i > 0 ? i : -1;
+      }
+      if(p->rwait && !p->wbusy){
+        p->rwait = 0;
+        wakeup(&p->nread);
+      }
+      p->wwait = 1;
+      sleep(&p->nwrite, &p->lock);
+    }
+    m = n - i;
+    if(m > p->nread + PIPESIZE - p->nwrite)
+      m = p->nread + PIPESIZE - p->nwrite;
+    if(m > PGSIZE - p->nwrite % PGSIZE)
+      m = PGSIZE - p->nwrite % PGSIZE;
+    off = p->nwrite;
+    p->wbusy = 1;
+    release(&p->lock);
+
+    if(f->type == FD_PIPE)
+      r = pipetake(f->pipe, pipeaddr(p, off), m);
+    else
+      r = fileread(f, pipeaddr(p, off), m);
+
+    acquire(&p->lock);
+    p->wbusy = 0;
+    if(r > 0)
+      p->nwrite += r;
+    if(p->rwait && r > 0){
+      p->rwait = 0;
+      wakeup(&p->nread);
+    }
+    if(p->wwait){
+      p->wwait = 0;
+      wakeup(&p->nwrite);
+    }
+    release(&p->lock);
+
+    if(r < 0)
+      return i > 0 ? i : -1;
+    if(f->type == FD_PIPE){
+      // emptied by another reader meanwhile: wait again
+      if(r > 0)
+        return i + r;
+      continue;
+    }
+    if(r < m)
+      return i + r;
+  }
+  return i;
+}
+
+// Splice: move up to n bytes from p to f, which writes them
+// straight from p's buffer. The span being drained is reserved
+// with rbusy. Waits only while p is empty and nothing has been
+// moved yet, like piperead. f may not be a pipe, which could
+// keep p's readers waiting on rbusy for as long as f is full;
+// filesplice moves pipe to pipe with pipesplicein instead.
+int
+pipespliceout(struct pipe *p, struct file *f, int n)
+{
+  int i, m, r;
+  uint off;
+
+  if(f->type == FD_PIPE)
+    return -1;
+
+  for(i = 0; i < n; i += r){
+    acquire(&p->lock);
+    while(p->rbusy || (p->nread == p->nwrite && p->writeopen && i == 0)){
+      if(myproc()->killed){
+        release(&p->lock);
+        return -1;
+      }
+      p->rwait = 1;
+      sleep(&p->nread, &p->lock);
+    }
+    if(p->nread == p->nwrite){
+      release(&p->lock);
+      break;
+    }
+    m = n - i;
+    if(m > p->nwrite - p->nread)
+      m = p->nwrite - p->nread;
+    if(m > PGSIZE - p->nread % PGSIZE)
+      m = PGSIZE - p->nread % PGSIZE;
+    off = p->nread;
+    p->rbusy = 1;
+    release(&p->lock);
+
+    r = filewrite(f, pipeaddr(p, off), m);
+
+    acquire(&p->lock);
+    p->rbusy = 0;
+    if(r > 0)
+      p->nread += r;
+    if(p->wwait && p->nread + PIPESIZE - p->nwrite >= PIPEWAKE){
+      p->wwait = 0;
+      wakeup(&p->nwrite);
+    }
+    if(p->rwait){
+      p->rwait = 0;
+      wakeup(&p->nread);
+    }
+    release(&p->lock);
+
+    if(r < 0)
+      return i > 0 ? i : -1;
+  }
+  return i;
+}
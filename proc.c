@@ -6,11 +6,21 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
 
+// number of sleep queues
+#define NSLEEPQ_BITS 6
+#define NSLEEPQ (1 << NSLEEPQ_BITS)
+
+// Sleeping processes are kept on ptable.sleepq[] hashed by chan, so
+// wakeup() only looks at processes sleeping on channels that share
+// its bucket. A sleeping process is on no run queue, so the sleep
+// queues reuse the run queue links p->qnext and p->qprev.
 struct
 {
     struct spinlock lock;
     struct proc proc[NPROC];
+    struct proc_queue sleepq[NSLEEPQ];
 } ptable;
 
 static struct proc *initproc;
@@ -24,15 +34,9 @@ static void wakeup1(void *chan);
 void pinit(void)
 {
     initlock(&ptable.lock, "ptable");
-    for (int i = 0; i < NQUE; i++)
-        queues[i] = 0;
-
-    for (int i = 0; i < NPROC; i++)
-    {
-        store[i].use = 0;
-        store[i].next = 0;
-        store[i].p = 0;
-    }
+    for (int i = 0; i < NSLEEPQ; i++)
+        q_init(&ptable.sleepq[i]);
+    sched_init();
 }
 
 // Must be called with interrupts disabled
@@ -76,20 +80,6 @@ myproc(void)
     return p;
 }
 
-// push the process in p->queue (ptable must be held)
-void push_process(struct proc *p)
-{
-
-    if (p->got_queue == 0)
-    {
-        p->got_queue = 1;
-        p->cticks = 0;
-        p->talloc = ticks;
-        p->ps_wtime = 0;
-        queues[p->queue] = push(queues[p->queue], p);
-    }
-}
-
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -116,6 +106,7 @@ found:
 
     //starttime = ticks and initialize rtime and etime to 0
     p->etime = 0;
+    p->tstate = ticks;
     p->rtime = 0;
     p->iotime = 0;
     p->ctime = ticks;
@@ -127,9 +118,20 @@ found:
     p->got_queue = 0;
     p->cticks = 0;
     p->queue = 0;
+    p->cpu = 0;
+    p->heapidx = -1;
+    p->vruntime = 0;
+    p->tickets = DEFAULT_TICKETS;
+    p->pass = 0;
+    p->dl_runtime = 0;
+    p->dl_period = 0;
+    p->dl_used = 0;
+    p->dl_throttled = 0;
+    p->dl_misses = 0;
+    p->exe = 0;
+    p->nexecseg = 0;
 
     p->n_run = 0;
-    p->ps_wtime = 0;
     for (int i = 0; i < 5; i++)
         p->q_ticks[i] = 0;
 
@@ -160,767 +162,821 @@ found:
     return p;
 }
 
-// Function to update rtime of running processes
-void upd_ptimes(void)
+// Move p to state s, charging the ticks spent in its old state to
+// rtime (RUNNING) or iotime (SLEEPING). Times are only accumulated on
+// state changes, so the timer interrupt never walks the table.
+// ptable.lock must be held.
+static void setstate(struct proc *p, enum procstate s)
 {
-    acquire(&ptable.lock);
+    uint now = ticks;
+
+    if (p->state == RUNNING)
+        p->rtime += now - p->tstate;
+    else if (p->state == SLEEPING)
+        p->iotime += now - p->tstate;
+    p->state = s;
+    p->tstate = now;
+}
+
+// rtime of p including its current run, if it is running
+static int proc_rtime(struct proc *p)
+{
+    if (p->state == RUNNING)
+        return p->rtime + (ticks - p->tstate);
+    return p->rtime;
+}
 
-    // loop over all processes and increase rtime for running ones and io time for sleeping ones
+#ifdef LOGS
+// Print the queue of every runnable process, once a tick
+void log_procs(void)
+{
+    acquire(&ptable.lock);
     for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++)
     {
-        if (p->state == RUNNING)
-        {
-            p->rtime++;
-#if SCHEDULER == MLFQ
-            p->q_ticks[p->queue]++;
-#endif
-        }
-        else if (p->state == SLEEPING)
-        {
-            p->iotime++;
-        }
-        else if (p->state == RUNNABLE)
-        {
-            p->ps_wtime++;
-#ifdef LOGS
-            if ((p->state == SLEEPING || p->state == RUNNABLE || p->state == RUNNING) && p->pid > 3)
-            {
-                cprintf("%d %d %d\n", ticks, p->pid, p->queue);
-            }
-#endif
-        }
-        release(&ptable.lock);
+        if (p->state == RUNNABLE && p->pid > 3)
+            cprintf("%d %d %d\n", ticks, p->pid, p->queue);
     }
+    release(&ptable.lock);
+}
+#endif
 
-    //PAGEBREAK: 32
-    // Set up first user process.
-    void userinit(void)
-    {
-        struct proc *p;
-        extern char _binary_initcode_start[], _binary_initcode_size[];
-
-        p = allocproc();
-
-        initproc = p;
-        if ((p->pgdir = setupkvm()) == 0)
-            panic("userinit: out of memory?");
-        inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
-        p->sz = PGSIZE;
-        memset(p->tf, 0, sizeof(*p->tf));
-        p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
-        p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
-        p->tf->es = p->tf->ds;
-        p->tf->ss = p->tf->ds;
-        p->tf->eflags = FL_IF;
-        p->tf->esp = PGSIZE;
-        p->tf->eip = 0; // beginning of initcode.S
-
-        safestrcpy(p->name, "initcode", sizeof(p->name));
-        p->cwd = namei("/");
-
-        // this assignment to p->state lets other cores
-        // run this process. the acquire forces the above
-        // writes to be visible, and the lock is also needed
-        // because the assignment might not be atomic.
-        acquire(&ptable.lock);
+//PAGEBREAK: 32
+// Set up first user process.
+void userinit(void)
+{
+    struct proc *p;
+    extern char _binary_initcode_start[], _binary_initcode_size[];
+
+    p = allocproc();
+
+    initproc = p;
+    if ((p->pgdir = setupkvm()) == 0)
+        panic("userinit: out of memory?");
+    inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
+    p->sz = PGSIZE;
+    memset(p->tf, 0, sizeof(*p->tf));
+    p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
+    p->tf->ds = (SEG_UDATA << 3) | DPL_USER;
+    p->tf->es = p->tf->ds;
+    p->tf->ss = p->tf->ds;
+    p->tf->eflags = FL_IF;
+    p->tf->esp = PGSIZE;
+    p->tf->eip = 0; // beginning of initcode.S
+
+    safestrcpy(p->name, "initcode", sizeof(p->name));
+    p->cwd = namei("/");
+
+    // this assignment to p->state lets other cores
+    // run this process. the acquire forces the above
+    // writes to be visible, and the lock is also needed
+    // because the assignment might not be atomic.
+    acquire(&ptable.lock);
 
-        p->state = RUNNABLE;
-#if SCHEDULER == MLFQ
-        push_process(p);
-#endif
-        release(&ptable.lock);
-    }
+    setstate(p, RUNNABLE);
+    push_process(p);
+    release(&ptable.lock);
+}
 
-    // Grow current process's memory by n bytes.
-    // Return 0 on success, -1 on failure.
-    int growproc(int n)
-    {
-        uint sz;
-        struct proc *curproc = myproc();
+// Grow current process's memory by n bytes.
+// Growing only reserves the address space: the pages are
+// allocated and zeroed on first touch (see pagefault in vm.c).
+// Return 0 on success, -1 on failure.
+int growproc(int n)
+{
+    uint sz;
+    struct execseg *s, *t;
+    struct proc *curproc = myproc();
 
-        sz = curproc->sz;
-        if (n > 0)
-        {
-            if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-                return -1;
-        }
-        else if (n < 0)
+    sz = curproc->sz;
+    if (n > 0)
+    {
+        if (sz + n < sz || sz + n >= KERNBASE)
+            return -1;
+        sz += n;
+    }
+    else if (n < 0)
+    {
+        if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+            return -1;
+        // Forget the parts of executable segments given up, so
+        // that memory grown there again is zeroed, not reloaded.
+        for (s = t = curproc->execseg; s < &curproc->execseg[curproc->nexecseg]; s++)
         {
-            if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-                return -1;
+            if (s->va >= sz)
+                continue;
+            *t = *s;
+            if (t->va + t->memsz > sz)
+                t->memsz = sz - t->va;
+            if (t->filesz > t->memsz)
+                t->filesz = t->memsz;
+            t++;
         }
-        curproc->sz = sz;
-        switchuvm(curproc);
-        return 0;
+        curproc->nexecseg = t - curproc->execseg;
     }
+    curproc->sz = sz;
+    switchuvm(curproc);
+    return 0;
+}
 
-    // Create a new process copying p as the parent.
-    // Sets up stack to return as if from system call.
-    // Caller must set state of returned proc to RUNNABLE.
-    int fork(void)
-    {
-        int i, pid;
-        struct proc *np;
-        struct proc *curproc = myproc();
+// Create a new process copying p as the parent.
+// Sets up stack to return as if from system call.
+// Caller must set state of returned proc to RUNNABLE.
+int fork(void)
+{
+    int i, pid;
+    struct proc *np;
+    struct proc *curproc = myproc();
 
-        // Allocate process.
-        if ((np = allocproc()) == 0)
-        {
-            return -1;
-        }
+    // Allocate process.
+    if ((np = allocproc()) == 0)
+    {
+        return -1;
+    }
 
-        // Copy process state from proc.
-        if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0)
-        {
-            kfree(np->kstack);
-            np->kstack = 0;
-            np->state = UNUSED;
-            return -1;
-        }
-        np->sz = curproc->sz;
-        np->parent = curproc;
-        *np->tf = *curproc->tf;
+    // Copy process state from proc.
+    if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0)
+    {
+        kfree(np->kstack);
+        np->kstack = 0;
+        np->state = UNUSED;
+        return -1;
+    }
+    np->sz = curproc->sz;
+    np->parent = curproc;
+    np->cpu = curproc->cpu;
+    np->tickets = curproc->tickets;
+    *np->tf = *curproc->tf;
 
-        // Clear %eax so that fork returns 0 in the child.
-        np->tf->eax = 0;
+    // Clear %eax so that fork returns 0 in the child.
+    np->tf->eax = 0;
 
-        for (i = 0; i < NOFILE; i++)
-            if (curproc->ofile[i])
-                np->ofile[i] = filedup(curproc->ofile[i]);
-        np->cwd = idup(curproc->cwd);
+    for (i = 0; i < NOFILE; i++)
+        if (curproc->ofile[i])
+            np->ofile[i] = filedup(curproc->ofile[i]);
+    np->cwd = idup(curproc->cwd);
+    if (curproc->exe)
+        np->exe = iexecdup(curproc->exe);
+    np->nexecseg = curproc->nexecseg;
+    memmove(np->execseg, curproc->execseg, sizeof(np->execseg));
 
-        safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+    safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
-        pid = np->pid;
+    pid = np->pid;
 
-        acquire(&ptable.lock);
+    acquire(&ptable.lock);
 
-        np->state = RUNNABLE;
-#if SCHEDULER == MLFQ
-        push_process(np);
-#endif
+    setstate(np, RUNNABLE);
+    push_process(np);
 
-        release(&ptable.lock);
+    release(&ptable.lock);
 
-        return pid;
-    }
+    return pid;
+}
 
-    // Exit the current process.  Does not return.
-    // An exited process remains in the zombie state
-    // until its parent calls wait() to find out it exited.
-    void exit(void)
-    {
-        struct proc *curproc = myproc();
-        struct proc *p;
-        int fd;
+// Exit the current process.  Does not return.
+// An exited process remains in the zombie state
+// until its parent calls wait() to find out it exited.
+void exit(void)
+{
+    struct proc *curproc = myproc();
+    struct proc *p;
+    int fd;
 
-        if (curproc == initproc)
-            panic("init exiting");
+    if (curproc == initproc)
+        panic("init exiting");
 
-        curproc->etime = ticks;
+    curproc->etime = ticks;
 
-        // Close all open files.
-        for (fd = 0; fd < NOFILE; fd++)
+    // Close all open files.
+    for (fd = 0; fd < NOFILE; fd++)
+    {
+        if (curproc->ofile[fd])
         {
-            if (curproc->ofile[fd])
-            {
-                fileclose(curproc->ofile[fd]);
-                curproc->ofile[fd] = 0;
-            }
+            fileclose(curproc->ofile[fd]);
+            curproc->ofile[fd] = 0;
         }
+    }
 
-        begin_op();
-        iput(curproc->cwd);
-        end_op();
-        curproc->cwd = 0;
+    begin_op();
+    iput(curproc->cwd);
+    if (curproc->exe)
+        iexecput(curproc->exe);
+    end_op();
+    curproc->cwd = 0;
+    curproc->exe = 0;
 
-        acquire(&ptable.lock);
+    acquire(&ptable.lock);
 
-        // Parent might be sleeping in wait().
-        wakeup1(curproc->parent);
+    // Parent might be sleeping in wait().
+    wakeup1(curproc->parent);
 
-        // Pass abandoned children to init.
-        for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    // Pass abandoned children to init.
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    {
+        if (p->parent == curproc)
         {
-            if (p->parent == curproc)
-            {
-                p->parent = initproc;
-                if (p->state == ZOMBIE)
-                    wakeup1(initproc);
-            }
+            p->parent = initproc;
+            if (p->state == ZOMBIE)
+                wakeup1(initproc);
         }
-
-        // Jump into the scheduler, never to return.
-        curproc->state = ZOMBIE;
-        sched();
-        panic("zombie exit");
     }
 
-    // Wait for a child process to exit and return its pid.
-    // Return -1 if this process has no children.
-    int wait(void)
-    {
-        struct proc *p;
-        int havekids, pid;
-        struct proc *curproc = myproc();
+    // Jump into the scheduler, never to return.
+    setstate(curproc, ZOMBIE);
+    sched();
+    panic("zombie exit");
+}
 
-        acquire(&ptable.lock);
-        for (;;)
-        {
-            // Scan through table looking for exited children.
-            havekids = 0;
-            for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-            {
-                if (p->parent != curproc)
-                    continue;
-                havekids = 1;
-                if (p->state == ZOMBIE)
-                {
-                    // Found one.
-                    pid = p->pid;
-                    kfree(p->kstack);
-                    p->kstack = 0;
-                    freevm(p->pgdir);
-                    p->pid = 0;
-                    p->parent = 0;
-                    p->name[0] = 0;
-                    p->killed = 0;
-                    p->state = UNUSED;
-                    release(&ptable.lock);
-                    return pid;
-                }
-            }
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+int wait(void)
+{
+    struct proc *p;
+    int havekids, pid;
+    struct proc *curproc = myproc();
 
-            // No point waiting if we don't have any children.
-            if (!havekids || curproc->killed)
+    acquire(&ptable.lock);
+    for (;;)
+    {
+        // Scan through table looking for exited children.
+        havekids = 0;
+        for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        {
+            if (p->parent != curproc)
+                continue;
+            havekids = 1;
+            if (p->state == ZOMBIE)
             {
+                // Found one.
+                pid = p->pid;
+                kfree(p->kstack);
+                p->kstack = 0;
+                freevm(p->pgdir);
+                p->pid = 0;
+                p->parent = 0;
+                p->name[0] = 0;
+                p->killed = 0;
+                p->state = UNUSED;
                 release(&ptable.lock);
-                return -1;
+                return pid;
             }
+        }
 
-            // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-            sleep(curproc, &ptable.lock); //DOC: wait-sleep
+        // No point waiting if we don't have any children.
+        if (!havekids || curproc->killed)
+        {
+            release(&ptable.lock);
+            return -1;
         }
+
+        // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+        sleep(curproc, &ptable.lock); //DOC: wait-sleep
     }
+}
 
-    // Wait for a child process to exit and return its pid.
-    // Return -1 if this process has no children.
-    // add waiting time and running time in wtime and rtime
-    int waitx(int *wtime, int *rtime)
-    {
-        struct proc *p;
-        int havekids, pid;
-        struct proc *curproc = myproc();
+// Wait for a child process to exit and return its pid.
+// Return -1 if this process has no children.
+// add waiting time and running time in wtime and rtime
+int waitx(int *wtime, int *rtime)
+{
+    struct proc *p;
+    int havekids, pid;
+    struct proc *curproc = myproc();
 
-        acquire(&ptable.lock);
-        for (;;)
+    acquire(&ptable.lock);
+    for (;;)
+    {
+        // Scan through table looking for exited children.
+        havekids = 0;
+        for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
         {
-            // Scan through table looking for exited children.
-            havekids = 0;
-            for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-            {
-                if (p->parent != curproc)
-                    continue;
-                havekids = 1;
-                if (p->state == ZOMBIE)
-                {
-                    // Found one.
-                    *rtime = p->rtime;
-                    *wtime = p->etime - p->ctime - p->rtime - p->iotime;
-
-                    pid = p->pid;
-                    kfree(p->kstack);
-                    p->kstack = 0;
-                    freevm(p->pgdir);
-                    p->pid = 0;
-                    p->parent = 0;
-                    p->name[0] = 0;
-                    p->killed = 0;
-                    p->state = UNUSED;
-                    release(&ptable.lock);
-                    return pid;
-                }
-            }
-
-            // No point waiting if we don't have any children.
-            if (!havekids || curproc->killed)
+            if (p->parent != curproc)
+                continue;
+            havekids = 1;
+            if (p->state == ZOMBIE)
             {
+                // Found one.
+                *rtime = p->rtime;
+                *wtime = p->etime - p->ctime - p->rtime - p->iotime;
+
+                pid = p->pid;
+                kfree(p->kstack);
+                p->kstack = 0;
+                freevm(p->pgdir);
+                p->pid = 0;
+                p->parent = 0;
+                p->name[0] = 0;
+                p->killed = 0;
+                p->state = UNUSED;
                 release(&ptable.lock);
-                return -1;
+                return pid;
             }
+        }
 
-            // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-            sleep(curproc, &ptable.lock); //DOC: wait-sleep
+        // No point waiting if we don't have any children.
+        if (!havekids || curproc->killed)
+        {
+            release(&ptable.lock);
+            return -1;
         }
+
+        // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+        sleep(curproc, &ptable.lock); //DOC: wait-sleep
     }
+}
 
-    int set_priority(int new_prior, int pid)
-    {
-        cprintf("new, %d %d\n", pid, new_prior);
-        if (new_prior < 0 || new_prior > 100)
-            return -1;
+int set_priority(int new_prior, int pid)
+{
+    cprintf("new, %d %d\n", pid, new_prior);
+    if (new_prior < 0 || new_prior > 100)
+        return -1;
 
-        int old_priority = -1;
-        acquire(&ptable.lock);
-        for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    int old_priority = -1;
+    acquire(&ptable.lock);
+    for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    {
+        if (p->pid == pid)
         {
-            if (p->pid == pid)
+            old_priority = p->priority;
+            if (p->got_queue)
             {
-                old_priority = p->priority;
+                // move it to the queue of its new priority
+                remove_process(p);
                 p->priority = new_prior;
-                if (new_prior != old_priority)
-                    p->timeslices = 0;
-                break;
+                push_process(p);
             }
+            else
+                p->priority = new_prior;
+            if (new_prior != old_priority)
+                p->timeslices = 0;
+            break;
         }
-        release(&ptable.lock);
+    }
+    release(&ptable.lock);
 
-        if (old_priority < 0)
-        {
-            // cprintf("HI %d\n", pid);
-            // pid not found
-            return -1;
-        }
+    if (old_priority < 0)
+    {
+        // cprintf("HI %d\n", pid);
+        // pid not found
+        return -1;
+    }
 
-        if (new_prior < old_priority)
-            yield();
+    if (new_prior < old_priority)
+        yield();
 
-        return old_priority;
-    }
+    return old_priority;
+}
 
-    //PAGEBREAK: 42
-    // Per-CPU process scheduler.
-    // Each CPU calls scheduler() after setting itself up.
-    // Scheduler never returns.  It loops, doing:
-    //  - choose a process to run
-    //  - swtch to start running that process
-    //  - eventually that process transfers control
-    //      via swtch back to the scheduler.
+// Give process pid a share of tickets (1 to MAX_TICKETS) of the cpu
+// under STRIDE and LOTTERY.
+// Returns its previous tickets, or -1 if tickets or pid are not valid.
+int settickets(int tickets, int pid)
+{
+    int old_tickets = -1;
 
-    void inc_cticks(struct proc * p)
-    {
-        // acquire(&ptable.lock);
-        p->cticks++;
-        // release(&ptable.lock);
-    }
+    if (tickets < 1 || tickets > MAX_TICKETS)
+        return -1;
 
-    int ps(void)
+    acquire(&ptable.lock);
+    for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++)
     {
-        struct proc *p;
-        static char *states[] = {
-            [UNUSED] "unused\t",
-            [EMBRYO] "embryo\t",
-            [SLEEPING] "sleeping",
-            [RUNNABLE] "runable\t",
-            [RUNNING] "running\t",
-            [ZOMBIE] "zombie\t",
-        };
-
-        // ps implementation
-        acquire(&ptable.lock);
-        cprintf("PID\tPriority\tState\tr_time\tw_time\tn_run\tcur_q\tq0\tq1\tq2\tq3\tq4\n");
-
-        for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        if (p->pid == pid && p->state != UNUSED)
         {
-            if (p->state == UNUSED)
-                continue;
-            cprintf("%d\t%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
-                    p->pid, p->priority, states[p->state], p->rtime, p->ps_wtime, p->n_run, p->queue,
-                    p->q_ticks[0], p->q_ticks[1], p->q_ticks[2], p->q_ticks[3], p->q_ticks[4]);
+            old_tickets = p->tickets;
+            if (p->got_queue)
+            {
+                // the lottery keeps the total of its queue
+                remove_process(p);
+                p->tickets = tickets;
+                push_process(p);
+            }
+            else
+                p->tickets = tickets;
+            break;
         }
-
-        release(&ptable.lock);
-        return 0;
     }
+    release(&ptable.lock);
 
-    void scheduler(void)
-    {
-        struct proc *p;
-#if SCHEDULER != RR
-        struct proc *selected;
-#endif
-        struct cpu *c = mycpu();
-        c->proc = 0;
+    return old_tickets;
+}
 
-        for (;;)
-        {
-            // Enable interrupts on this processor.
-            sti();
+// Make the current process a deadline process that gets runtime ticks
+// of cpu every period ticks, scheduled earliest deadline first ahead
+// of the current policy. runtime 0 makes it a normal process again.
+// Refused if the deadline processes together would want more than
+// DL_MAX_UTIL of one cpu. Zombies no longer count.
+// Returns 0, or -1 if the arguments are not valid or not admitted.
+int sched_deadline(int runtime, int period)
+{
+    struct proc *curproc = myproc();
+    int util = 0;
 
-            // Loop over process table looking for process to run.
-            acquire(&ptable.lock);
+    if (runtime < 0 || period < 0 || period > DL_MAX_PERIOD ||
+        (runtime > 0 && runtime > period))
+        return -1;
 
-#if SCHEDULER == RR
-            for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-            {
-                if (p->state != RUNNABLE)
-                    continue;
+    acquire(&ptable.lock);
+    if (runtime > 0)
+    {
+        for (struct proc *p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        {
+            if (p->state != UNUSED && p->state != ZOMBIE && p->dl_period && p != curproc)
+                util += (p->dl_runtime * 1000 + p->dl_period - 1) / p->dl_period;
+        }
+        util += (runtime * 1000 + period - 1) / period;
+        if (util > DL_MAX_UTIL)
+        {
+            release(&ptable.lock);
+            return -1;
+        }
+    }
 
-                // Switch to chosen process.  It is the process's job
-                // to release ptable.lock and then reacquire it
-                // before jumping back to us.
-                p->n_run++;
-                p->ps_wtime = 0;
+    // curproc is running, so it is on no run queue
+    curproc->dl_runtime = runtime;
+    curproc->dl_period = runtime > 0 ? period : 0;
+    curproc->dl_deadline = ticks + period;
+    curproc->dl_used = 0;
+    curproc->dl_misses = 0;
+    release(&ptable.lock);
+
+    return 0;
+}
 
-                c->proc = p;
-                switchuvm(p);
-                p->state = RUNNING;
+// Switch every cpu to scheduling policy (RR, FCFS, PBS, MLFQ, CFS,
+// STRIDE or LOTTERY).
+// Queued processes are moved to the new policy's queues; MLFQ levels
+// start over at queue 0.
+// Returns the previous policy, or -1 if policy is not valid.
+int set_scheduler(int policy)
+{
+    struct proc *p;
+    int old;
 
-                swtch(&(c->scheduler), p->context);
-                switchkvm();
+    if (policy < 0 || policy >= NSCHED)
+        return -1;
 
-                // Process is done running for now.
-                // It should have changed its p->state before coming back.
-                c->proc = 0;
+    acquire(&ptable.lock);
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        remove_process(p);
+    old = sched_setclass(policy);
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    {
+        p->queue = 0;
+        if (p->state == RUNNABLE)
+            push_process(p);
+    }
+    release(&ptable.lock);
 
-                // after finishing process runnable then reshedule
-            }
-#elif SCHEDULER == FCFS
+    return old;
+}
 
-            selected = 0;
-            int earliest = ticks + 100;
+//PAGEBREAK: 42
+// Per-CPU process scheduler.
+// Each CPU calls scheduler() after setting itself up.
+// Scheduler never returns.  It loops, doing:
+//  - choose a process to run
+//  - swtch to start running that process
+//  - eventually that process transfers control
+//      via swtch back to the scheduler.
 
-            // run through all the processes and pick the earlieast one
-            for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-            {
-                if (p->state != RUNNABLE)
-                    continue;
-
-                if (p->ctime < earliest)
-                {
-                    earliest = p->ctime;
-                    selected = p;
-                }
-            }
+int ps(void)
+{
+    struct proc *p;
+    int total = 0;
+    static char *states[] = {
+        [UNUSED] "unused\t",
+        [EMBRYO] "embryo\t",
+        [SLEEPING] "sleeping",
+        [RUNNABLE] "runable\t",
+        [RUNNING] "running\t",
+        [ZOMBIE] "zombie\t",
+    };
+
+    // ps implementation
+    acquire(&ptable.lock);
+    cprintf("PID\tPriority\tState\tr_time\tw_time\tn_run\tcur_q\tq0\tq1\tq2\tq3\tq4\ttickets\tshare\tdl_miss\n");
 
-            if (selected)
-            {
-                selected->n_run++;
-                selected->ps_wtime = 0;
-                c->proc = selected;
-                switchuvm(selected);
-                selected->state = RUNNING;
-
-                swtch(&(c->scheduler), selected->context);
-                switchkvm();
-
-                // Process is done running for now.
-                // It should have changed its p->state before coming back.
-                c->proc = 0;
-            }
+    // share is each process's percentage of the run time of all
+    // processes listed, to compare against its tickets
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+        if (p->state != UNUSED)
+            total += proc_rtime(p);
 
-#elif SCHEDULER == PBS
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    {
+        if (p->state == UNUSED)
+            continue;
+        cprintf("%d\t%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d%%\t%d\n",
+                p->pid, p->priority, states[p->state], proc_rtime(p),
+                p->state == RUNNABLE ? ticks - p->tstate : 0, p->n_run, p->queue,
+                p->q_ticks[0], p->q_ticks[1], p->q_ticks[2], p->q_ticks[3], p->q_ticks[4],
+                p->tickets, total ? proc_rtime(p) * 100 / total : 0, p->dl_misses);
+    }
 
-            selected = 0;
-            int highest = 101;
-            int min_time = ticks + 100;
+    release(&ptable.lock);
+    return 0;
+}
 
-            for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-            {
-                if (p->state != RUNNABLE)
-                    continue;
-
-                if (p->priority < highest)
-                {
-                    highest = p->priority;
-                    min_time = p->timeslices;
-                    selected = p;
-                }
-                else if (p->priority == highest && p->timeslices < min_time)
-                {
-                    min_time = p->timeslices;
-                    selected = p;
-                }
-            }
+// Nothing to run: halt until an interrupt arrives instead of spinning.
+// A cpu that queues work kicks idle cpus with an IPI (see kick_idle), so
+// cpus other than cpu 0 also stop their timer while halted; cpu 0 keeps
+// ticking since its timer drives ticks and wakes sleepers.
+static void idle(struct cpu *c)
+{
+    cli();
+    c->idle = 1;
+    __sync_synchronize();
 
-            if (selected)
-            {
-                // selected a process
-                // inc the timeslices
-                selected->timeslices++;
-                selected->n_run++;
-                selected->ps_wtime = 0;
-
-                c->proc = selected;
-                switchuvm(selected);
-                selected->state = RUNNING;
-
-                swtch(&(c->scheduler), selected->context);
-                switchkvm();
-
-                // Process is done running for now.
-                // It should have changed its p->state before coming back.
-                c->proc = 0;
-            }
+    // look again now that kick_idle can see us, so a process queued
+    // in between is not missed
+    if (!sched_runnable(c))
+    {
+        if (c != &cpus[0])
+            lapictimer(0);
+        stihlt();
+        cli();
+        if (c != &cpus[0])
+            lapictimer(1);
+    }
 
-#elif SCHEDULER == MLFQ
+    c->idle = 0;
+}
 
-            //add to queue processes which dont have a queue
-            for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-            {
-                if (p->state == RUNNABLE)
-                {
-                    if (p->got_queue == 0)
-                    {
-                        push_process(p);
-                    }
-                    else
-                    {
-                        // age >= AGE_THRESH
-                        if ((ticks - p->talloc) >= AGE_THERSH && p->queue > 0)
-                        {
-
-                            queues[p->queue] = pop(queues[p->queue]);
-                            p->got_queue = 0;
-                            p->queue--;
-                            push_process(p);
-#ifdef DEBUG
-                            cprintf("UPGRADING [%d] to [%d]\n", p->pid, p->queue);
-#endif
-                        }
-                    }
-                }
-            }
+void scheduler(void)
+{
+    struct proc *p;
+    struct cpu *c = mycpu();
+    c->proc = 0;
 
-            selected = 0;
-            // search in ques
-            for (int i = 0; i < NQUE; i++)
-            {
-                if (queues[i] != 0)
-                {
-                    selected = queues[i]->p;
-                    selected->n_run++;
-                    selected->ps_wtime = 0;
-                    selected->got_queue = 0;
-                    selected->cticks = 0;
-                    queues[i] = pop(queues[i]);
-#ifdef DEBUG
-                    // cprintf("RUNNING [%d] from queue [%d]\n", selected->pid, selected->queue);
-#endif
+    for (;;)
+    {
+        // Enable interrupts on this processor.
+        sti();
 
-                    break;
-                }
-            }
+        // Idle CPUs halt here without touching ptable.lock.
+        if (!sched_runnable(c))
+        {
+            idle(c);
+            continue;
+        }
 
-            if (!selected)
-            {
-                release(&ptable.lock);
-                continue;
-            }
+        // Pick under the run queue's lock only; ptable.lock is
+        // just for the switch.
+        if ((p = sched_dequeue(c)) == 0)
+            continue;
 
-            c->proc = selected;
-            switchuvm(selected);
-            selected->state = RUNNING;
+        acquire(&ptable.lock);
 
-            swtch(&(c->scheduler), selected->context);
+        // Meanwhile p may have been queued again and run by
+        // another cpu; then it is not ours to run.
+        if (p->state == RUNNABLE && !p->got_queue)
+        {
+            // Switch to chosen process.  It is the process's job
+            // to release ptable.lock and then reacquire it
+            // before jumping back to us.
+            sched_migrate(p, c - cpus);
+            p->n_run++;
+            p->cticks = 0;
+
+            c->proc = p;
+            switchuvm(p);
+            setstate(p, RUNNING);
+
+            swtch(&(c->scheduler), p->context);
             switchkvm();
 
             // Process is done running for now.
             // It should have changed its p->state before coming back.
             c->proc = 0;
 
-            // process ended
-            if (selected->state == RUNNABLE)
-            {
-#ifdef DEBUG
-                // cprintf("PROCESS [%d] from queue [%d] exited with state RUNNABLE\n", selected->pid, selected->queue);
-#endif
-                if (selected->cticks >= (1 << (selected->queue)))
-                {
-                    if (selected->queue != NQUE - 1)
-                        selected->queue++;
-                }
+            // it yielded, put it back on our run queue
+            if (p->state == RUNNABLE)
                 push_process(p);
-            }
-
-#endif
-            release(&ptable.lock);
         }
-    }
 
-    // Enter scheduler.  Must hold only ptable.lock
-    // and have changed proc->state. Saves and restores
-    // intena because intena is a property of this
-    // kernel thread, not this CPU. It should
-    // be proc->intena and proc->ncli, but that would
-    // break in the few places where a lock is held but
-    // there's no process.
-    void sched(void)
-    {
-        int intena;
-        struct proc *p = myproc();
-
-        if (!holding(&ptable.lock))
-            panic("sched ptable.lock");
-        if (mycpu()->ncli != 1)
-            panic("sched locks");
-        if (p->state == RUNNING)
-            panic("sched running");
-        if (readeflags() & FL_IF)
-            panic("sched interruptible");
-        intena = mycpu()->intena;
-        swtch(&p->context, mycpu()->scheduler);
-        mycpu()->intena = intena;
-    }
-
-    // Give up the CPU for one scheduling round.
-    void yield(void)
-    {
-        acquire(&ptable.lock); //DOC: yieldlock
-        myproc()->state = RUNNABLE;
-        sched();
         release(&ptable.lock);
     }
+}
 
-    // A fork child's very first scheduling by scheduler()
-    // will swtch here.  "Return" to user space.
-    void forkret(void)
-    {
-        static int first = 1;
-        // Still holding ptable.lock from scheduler.
-        release(&ptable.lock);
+// Enter scheduler.  Must hold only ptable.lock
+// and have changed proc->state. Saves and restores
+// intena because intena is a property of this
+// kernel thread, not this CPU. It should
+// be proc->intena and proc->ncli, but that would
+// break in the few places where a lock is held but
+// there's no process.
+void sched(void)
+{
+    int intena;
+    struct proc *p = myproc();
+
+    if (!holding(&ptable.lock))
+        panic("sched ptable.lock");
+    if (mycpu()->ncli != 1)
+        panic("sched locks");
+    if (p->state == RUNNING)
+        panic("sched running");
+    if (readeflags() & FL_IF)
+        panic("sched interruptible");
+    intena = mycpu()->intena;
+    swtch(&p->context, mycpu()->scheduler);
+    mycpu()->intena = intena;
+}
 
-        if (first)
-        {
-            // Some initialization functions must be run in the context
-            // of a regular process (e.g., they call sleep), and thus cannot
-            // be run from main().
-            first = 0;
-            iinit(ROOTDEV);
-            initlog(ROOTDEV);
-        }
+// Give up the CPU for one scheduling round.
+void yield(void)
+{
+    acquire(&ptable.lock); //DOC: yieldlock
+    setstate(myproc(), RUNNABLE);
+    sched();
+    release(&ptable.lock);
+}
 
-        // Return to "caller", actually trapret (see allocproc).
-    }
+// Start a kernel thread running fn, which must never return.
+// It has no user memory and no parent.
+int kthread(char *name, void (*fn)(void))
+{
+    struct proc *p;
 
-    // Atomically release lock and sleep on chan.
-    // Reacquires lock when awakened.
-    void sleep(void *chan, struct spinlock *lk)
+    if ((p = allocproc()) == 0)
+        return -1;
+    if ((p->pgdir = setupkvm()) == 0)
     {
-        struct proc *p = myproc();
-
-        if (p == 0)
-            panic("sleep");
-
-        if (lk == 0)
-            panic("sleep without lk");
-
-        // Must acquire ptable.lock in order to
-        // change p->state and then call sched.
-        // Once we hold ptable.lock, we can be
-        // guaranteed that we won't miss any wakeup
-        // (wakeup runs with ptable.lock locked),
-        // so it's okay to release lk.
-        if (lk != &ptable.lock)
-        {                          //DOC: sleeplock0
-            acquire(&ptable.lock); //DOC: sleeplock1
-            release(lk);
-        }
-        // Go to sleep.
-        p->chan = chan;
-        p->state = SLEEPING;
+        kfree(p->kstack);
+        p->kstack = 0;
+        p->state = UNUSED;
+        return -1;
+    }
+    // forkret returns to fn instead of trapret.
+    *(uint *)(p->context + 1) = (uint)fn;
+    safestrcpy(p->name, name, sizeof(p->name));
 
-        sched();
+    acquire(&ptable.lock);
+    setstate(p, RUNNABLE);
+    push_process(p);
+    release(&ptable.lock);
+    return p->pid;
+}
 
-        // Tidy up.
-        p->chan = 0;
+// A fork child's very first scheduling by scheduler()
+// will swtch here.  "Return" to user space.
+void forkret(void)
+{
+    static int first = 1;
+    // Still holding ptable.lock from scheduler.
+    release(&ptable.lock);
 
-        // Reacquire original lock.
-        if (lk != &ptable.lock)
-        { //DOC: sleeplock2
-            release(&ptable.lock);
-            acquire(lk);
-        }
+    if (first)
+    {
+        // Some initialization functions must be run in the context
+        // of a regular process (e.g., they call sleep), and thus cannot
+        // be run from main().
+        first = 0;
+        iinit(ROOTDEV);
+        initlog(ROOTDEV);
     }
 
-    //PAGEBREAK!
-    // Wake up all processes sleeping on chan.
-    // The ptable lock must be held.
-    static void
-    wakeup1(void *chan)
-    {
-        struct proc *p;
+    // Return to "caller", actually trapret (see allocproc).
+}
 
-        for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-            if (p->state == SLEEPING && p->chan == chan)
-            {
-                p->state = RUNNABLE;
-#if SCHEDULER == MLFQ
-                push_process(p);
-#endif
-            }
+// sleep queue of chan (Fibonacci hashing of the address)
+static struct proc_queue *
+chan_queue(void *chan)
+{
+    return &ptable.sleepq[((uint)chan * 2654435769u) >> (32 - NSLEEPQ_BITS)];
+}
+
+// Atomically release lock and sleep on chan.
+// Reacquires lock when awakened.
+void sleep(void *chan, struct spinlock *lk)
+{
+    struct proc *p = myproc();
+
+    if (p == 0)
+        panic("sleep");
+
+    if (lk == 0)
+        panic("sleep without lk");
+
+    // Must acquire ptable.lock in order to
+    // change p->state and then call sched.
+    // Once we hold ptable.lock, we can be
+    // guaranteed that we won't miss any wakeup
+    // (wakeup runs with ptable.lock locked),
+    // so it's okay to release lk.
+    if (lk != &ptable.lock)
+    {                          //DOC: sleeplock0
+        acquire(&ptable.lock); //DOC: sleeplock1
+        release(lk);
     }
+    // Go to sleep.
+    p->chan = chan;
+    setstate(p, SLEEPING);
+    q_push(chan_queue(chan), p);
 
-    // Wake up all processes sleeping on chan.
-    void wakeup(void *chan)
-    {
-        acquire(&ptable.lock);
-        wakeup1(chan);
+    sched();
+
+    // Tidy up.
+    p->chan = 0;
+
+    // Reacquire original lock.
+    if (lk != &ptable.lock)
+    { //DOC: sleeplock2
         release(&ptable.lock);
+        acquire(lk);
     }
+}
 
-    // Kill the process with the given pid.
-    // Process won't exit until it returns
-    // to user space (see trap in trap.c).
-    int kill(int pid)
-    {
-        struct proc *p;
+//PAGEBREAK!
+// Wake up all processes sleeping on chan.
+// The ptable lock must be held.
+static void
+wakeup1(void *chan)
+{
+    struct proc_queue *q = chan_queue(chan);
+    struct proc *p, *next;
 
-        acquire(&ptable.lock);
-        for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    for (p = q->head; p; p = next)
+    {
+        next = p->qnext;
+        if (p->chan == chan)
         {
-            if (p->pid == pid)
-            {
-                p->killed = 1;
-                // Wake process from sleep if necessary.
-                if (p->state == SLEEPING)
-                {
-                    p->state = RUNNABLE;
-#if SCHEDULER == MLFQ
-                    push_process(p);
-#endif
-                }
-                release(&ptable.lock);
-                return 0;
-            }
+            q_remove(q, p);
+            setstate(p, RUNNABLE);
+            push_process(p);
         }
-        release(&ptable.lock);
-        return -1;
     }
+}
 
-    //PAGEBREAK: 36
-    // Print a process listing to console.  For debugging.
-    // Runs when user types ^P on console.
-    // No lock to avoid wedging a stuck machine further.
-    void procdump(void)
-    {
-        static char *states[] = {
-            [UNUSED] "unused",
-            [EMBRYO] "embryo",
-            [SLEEPING] "sleep ",
-            [RUNNABLE] "runble",
-            [RUNNING] "run   ",
-            [ZOMBIE] "zombie"};
-        int i;
-        struct proc *p;
-        char *state;
-        uint pc[10];
+// Wake up all processes sleeping on chan.
+void wakeup(void *chan)
+{
+    acquire(&ptable.lock);
+    wakeup1(chan);
+    release(&ptable.lock);
+}
 
-        for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+// Kill the process with the given pid.
+// Process won't exit until it returns
+// to user space (see trap in trap.c).
+int kill(int pid)
+{
+    struct proc *p;
+
+    acquire(&ptable.lock);
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    {
+        if (p->pid == pid)
         {
-            if (p->state == UNUSED)
-                continue;
-            if (p->state >= 0 && p->state < NELEM(states) && states[p->state])
-                state = states[p->state];
-            else
-                state = "???";
-            cprintf("%d %s %s", p->pid, state, p->name);
+            p->killed = 1;
+            // Wake process from sleep if necessary.
             if (p->state == SLEEPING)
             {
-                getcallerpcs((uint *)p->context->ebp + 2, pc);
-                for (i = 0; i < 10 && pc[i] != 0; i++)
-                    cprintf(" %p", pc[i]);
+                q_remove(chan_queue(p->chan), p);
+                setstate(p, RUNNABLE);
+                push_process(p);
             }
-            cprintf("\n");
+            release(&ptable.lock);
+            return 0;
         }
     }
+    release(&ptable.lock);
+    return -1;
+}
+
+//PAGEBREAK: 36
+// Print a process listing to console.  For debugging.
+// Runs when user types ^P on console.
+// No lock to avoid wedging a stuck machine further.
+void procdump(void)
+{
+    static char *states[] = {
+        [UNUSED] "unused",
+        [EMBRYO] "embryo",
+        [SLEEPING] "sleep ",
+        [RUNNABLE] "runble",
+        [RUNNING] "run   ",
+        [ZOMBIE] "zombie"};
+    int i;
+    struct proc *p;
+    char *state;
+    uint pc[10];
+
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    {
+        if (p->state == UNUSED)
+            continue;
+        if (p->state >= 0 && p->state < NELEM(states) && states[p->state])
+            state = states[p->state];
+        else
+            state = "???";
+        cprintf("%d %s %s", p->pid, state, p->name);
+        if (p->state == SLEEPING)
+        {
+            getcallerpcs((uint *)p->context->ebp + 2, pc);
+            for (i = 0; i < 10 && pc[i] != 0; i++)
+                cprintf(" %p", pc[i]);
+        }
+        cprintf("\n");
+    }
+}
@@ -9,6 +9,7 @@ struct cpu
     int ncli;                  // Depth of pushcli nesting.
     int intena;                // Were interrupts enabled before pushcli?
     struct proc *proc;         // The process running on this cpu or null
+    volatile int idle;         // Halted in the scheduler waiting for work?
 };
 
 extern struct cpu cpus[NCPU];
@@ -34,6 +35,16 @@ struct context
     uint eip;
 };
 
+// Loadable segment of a process's executable, read in from the
+// inode a few pages at a time as it is touched (see pagefault)
+struct execseg
+{
+    uint va;     // start address, page aligned
+    uint memsz;  // size in memory
+    uint off;    // offset in the file
+    uint filesz; // bytes read from the file, the rest is zero
+};
+
 enum procstate
 {
     UNUSED,
@@ -64,15 +75,35 @@ struct proc
     int etime;                  // end time
     int rtime;                  // total time
     int iotime;                 // ticks for whjch the process was sleeping
+    uint tstate;                // tick the process entered its current state
     int priority;               // priority of the process
     int timeslices;             // slices of time taken by this process
     int cticks;                 // ticks for the process in this queue
     int queue;                  // queue of the process
     int got_queue;              // has the process got queue
     int talloc;                 // time to store last queue allocation
-    int ps_wtime;               // wtime for ps
     int n_run;                  // number of this process is picked by the scheduler
     int q_ticks[5];             // ticks taken in queue i
+    struct proc *qnext;         // next process in the run queue
+    struct proc *qprev;         // previous process in the run queue
+    int cpu;                    // cpu whose run queue this process uses
+    int heapidx;                // slot in the run queue heap, if any
+    uint vruntime;              // weighted run time in 1/1024 ticks (CFS)
+    struct proc *rbparent;      // run queue tree links (CFS)
+    struct proc *rbleft;
+    struct proc *rbright;
+    int rbred;                  // red-black tree node colour
+    int tickets;                // share of the cpu (STRIDE, LOTTERY)
+    uint pass;                  // stride run time, STRIDE1 / tickets per tick
+    int dl_runtime;             // deadline: ticks of cpu wanted every period
+    int dl_period;              // deadline: period in ticks, 0 if not a deadline process
+    uint dl_deadline;           // deadline: tick the current period ends
+    int dl_used;                // deadline: ticks run in the current period
+    int dl_throttled;           // deadline: out of runtime until dl_deadline
+    int dl_misses;              // deadline: periods that ended short of dl_runtime
+    struct inode *exe;          // executable the segments are read from, or 0
+    int nexecseg;               // number of demand-loaded segments
+    struct execseg execseg[NEXECSEG];
 };
 
 // Scheduling algorithms options
@@ -81,6 +112,12 @@ struct proc
 #define FCFS 1
 #define PBS 2
 #define MLFQ 3
+#define CFS 4
+#define STRIDE 5
+#define LOTTERY 6
+
+// number of scheduling algorithms
+#define NSCHED 7
 
 // Process memory is laid out contiguously, low addresses first:
 //   text
@@ -88,18 +125,54 @@ struct proc
 //   fixed-size stack
 //   expandable heap
 
-// Struct for MLFQ scheduling nodes
-struct proc_node
+// Intrusive FIFO of processes used for the run queues
+struct proc_queue
+{
+    struct proc *head; // first process in the queue
+    struct proc *tail; // last process in the queue
+};
+
+// Binary min-heap of processes, ordered by before()
+struct proc_heap
+{
+    int n;                                       // number of processes in p
+    int (*before)(struct proc *, struct proc *); // non-zero if a goes before b
+    struct proc *p[NPROC];                       // heap array
+};
+
+// Red-black tree of processes, ordered by before()
+struct proc_rbtree
 {
-    struct proc *p;         // Pointer to process
-    struct proc_node *next; // pointer to next node
-    int use;                // Has this node been used 0 for no 1 for yes
+    struct proc *root;                           // root of the tree
+    struct proc *leftmost;                       // first process in order
+    int (*before)(struct proc *, struct proc *); // non-zero if a goes before b
 };
 
+// CFS: minimum ticks a process runs before it can be preempted
+#ifndef CFS_GRANULARITY
+#define CFS_GRANULARITY 2
+#endif
+
+// CFS: weight of a process with the default priority (60)
+#define NICE_0_WEIGHT 1024
+
+// STRIDE, LOTTERY: tickets of a new process, and the most it can hold
+#define DEFAULT_TICKETS 100
+#define MAX_TICKETS 10000
+
+// STRIDE: pass advance per tick of a process holding one ticket
+#define STRIDE1 (1 << 20)
+
+// deadline processes may use at most this much of the cpu, in 1/1000
+#define DL_MAX_UTIL 900
+// longest deadline period in ticks; keeps runtime * 1000 within an int
+#define DL_MAX_PERIOD 1000000
+
 // number of queues
 #define NQUE 5
 
+// number of run queue levels: PBS priorities go from 0 to 100
+#define NLEVEL 101
+
 // Aging thresh
 #define AGE_THERSH 10
-struct proc_node store[NPROC];
-struct proc_node *queues[NQUE];
@@ -1,4 +1,3 @@
-
 #include "types.h"
 #include "defs.h"
 #include "memlayout.h"
@@ -9,53 +8,406 @@
 #include "traps.h"
 #include "x86.h"
 
-struct proc_node *q_alloc()
+// Run queues are intrusive doubly linked lists threaded through
+// p->qnext / p->qprev, so every operation below is O(1) and needs no
+// node allocation. The caller must hold the lock of the run queue
+// that q belongs to.
+
+void q_init(struct proc_queue *q)
+{
+    q->head = 0;
+    q->tail = 0;
+}
+
+// append p at the tail of q
+void q_push(struct proc_queue *q, struct proc *p)
+{
+    p->qnext = 0;
+    p->qprev = q->tail;
+
+    if (q->tail)
+        q->tail->qnext = p;
+    else
+        q->head = p;
+    q->tail = p;
+}
+
+// remove and return the head of q (0 if q is empty)
+struct proc *q_pop(struct proc_queue *q)
+{
+    struct proc *p = q->head;
+
+    if (p)
+        q_remove(q, p);
+    return p;
+}
+
+// unlink p from q, wherever it is in the queue
+void q_remove(struct proc_queue *q, struct proc *p)
+{
+    if (p->qprev)
+        p->qprev->qnext = p->qnext;
+    else
+        q->head = p->qnext;
+
+    if (p->qnext)
+        p->qnext->qprev = p->qprev;
+    else
+        q->tail = p->qprev;
+
+    p->qnext = 0;
+    p->qprev = 0;
+}
+
+// Binary min-heaps of processes. h->before(a, b) is the ordering and
+// p->heapidx is p's slot in h->p, so removing any process is
+// O(log n) without a search. The caller must hold the lock of the
+// run queue that h belongs to.
+
+void heap_init(struct proc_heap *h, int (*before)(struct proc *, struct proc *))
+{
+    h->n = 0;
+    h->before = before;
+}
+
+static void heap_set(struct proc_heap *h, int i, struct proc *p)
+{
+    h->p[i] = p;
+    p->heapidx = i;
+}
+
+// move the process in slot i towards the root until the heap is ordered
+static void heap_up(struct proc_heap *h, int i)
 {
-    for (int i = 0; i < NPROC; i++)
+    struct proc *p = h->p[i];
+
+    while (i > 0 && h->before(p, h->p[(i - 1) / 2]))
     {
-        if (store[i].use == 0)
-        {
-            // cprintf("IN ALLOCATION\n");
-            store[i].use = 1;
-            return &store[i];
-        }
+        heap_set(h, i, h->p[(i - 1) / 2]);
+        i = (i - 1) / 2;
+    }
+    heap_set(h, i, p);
+}
+
+// move the process in slot i towards the leaves until the heap is ordered
+static void heap_down(struct proc_heap *h, int i)
+{
+    struct proc *p = h->p[i];
+    int c;
+
+    while ((c = 2 * i + 1) < h->n)
+    {
+        if (c + 1 < h->n && h->before(h->p[c + 1], h->p[c]))
+            c++;
+        if (!h->before(h->p[c], p))
+            break;
+        heap_set(h, i, h->p[c]);
+        i = c;
     }
-    return 0;
+    heap_set(h, i, p);
 }
 
-void q_free(struct proc_node *p)
+void heap_push(struct proc_heap *h, struct proc *p)
 {
-    // cprintf("FREEING %d\n", p->p->pid);
-    p->use = 0;
+    if (h->n == NPROC)
+        panic("heap_push");
+    h->p[h->n++] = p;
+    heap_up(h, h->n - 1);
 }
 
-struct proc_node *push(struct proc_node *head, struct proc *p)
+// first process in heap order (0 if h is empty)
+struct proc *heap_min(struct proc_heap *h)
 {
-    struct proc_node *new = q_alloc();
-    new->p = p;
-    new->next = 0;
+    return h->n ? h->p[0] : 0;
+}
 
-    if (head == 0)
+void heap_remove(struct proc_heap *h, struct proc *p)
+{
+    int i = p->heapidx;
+
+    if (i < 0 || i >= h->n || h->p[i] != p)
+        panic("heap_remove");
+
+    h->n--;
+    if (i != h->n)
     {
-        return new;
+        struct proc *last = h->p[h->n];
+
+        heap_set(h, i, last);
+        heap_up(h, i);
+        heap_down(h, last->heapidx);
     }
+    p->heapidx = -1;
+}
+
+// Red-black trees of processes, threaded through p->rbparent,
+// p->rbleft, p->rbright and p->rbred and ordered by t->before(a, b).
+// The first process in order is cached in t->leftmost, so finding it
+// is O(1) and insert/remove are O(log n). The caller must hold the
+// lock of the run queue that t belongs to.
+
+void rb_init(struct proc_rbtree *t, int (*before)(struct proc *, struct proc *))
+{
+    t->root = 0;
+    t->leftmost = 0;
+    t->before = before;
+}
+
+static void rb_rotate_left(struct proc_rbtree *t, struct proc *x)
+{
+    struct proc *y = x->rbright;
 
-    struct proc_node *i = head;
-    while (i->next != 0)
+    x->rbright = y->rbleft;
+    if (y->rbleft)
+        y->rbleft->rbparent = x;
+    y->rbparent = x->rbparent;
+    if (x->rbparent == 0)
+        t->root = y;
+    else if (x == x->rbparent->rbleft)
+        x->rbparent->rbleft = y;
+    else
+        x->rbparent->rbright = y;
+    y->rbleft = x;
+    x->rbparent = y;
+}
+
+static void rb_rotate_right(struct proc_rbtree *t, struct proc *x)
+{
+    struct proc *y = x->rbleft;
+
+    x->rbleft = y->rbright;
+    if (y->rbright)
+        y->rbright->rbparent = x;
+    y->rbparent = x->rbparent;
+    if (x->rbparent == 0)
+        t->root = y;
+    else if (x == x->rbparent->rbright)
+        x->rbparent->rbright = y;
+    else
+        x->rbparent->rbleft = y;
+    y->rbright = x;
+    x->rbparent = y;
+}
+
+static int rb_isred(struct proc *p)
+{
+    return p != 0 && p->rbred;
+}
+
+void rb_insert(struct proc_rbtree *t, struct proc *p)
+{
+    struct proc **link = &t->root;
+    struct proc *parent = 0, *gp, *uncle;
+    int leftmost = 1;
+
+    while (*link)
     {
-        i = i->next;
+        parent = *link;
+        if (t->before(p, parent))
+            link = &parent->rbleft;
+        else
+        {
+            link = &parent->rbright;
+            leftmost = 0;
+        }
     }
-    i->next = new;
 
-    return head;
+    p->rbparent = parent;
+    p->rbleft = 0;
+    p->rbright = 0;
+    p->rbred = 1;
+    *link = p;
+    if (leftmost)
+        t->leftmost = p;
+
+    // restore the red-black properties
+    while ((parent = p->rbparent) != 0 && parent->rbred)
+    {
+        gp = parent->rbparent;
+        if (parent == gp->rbleft)
+        {
+            uncle = gp->rbright;
+            if (rb_isred(uncle))
+            {
+                parent->rbred = 0;
+                uncle->rbred = 0;
+                gp->rbred = 1;
+                p = gp;
+                continue;
+            }
+            if (p == parent->rbright)
+            {
+                p = parent;
+                rb_rotate_left(t, p);
+                parent = p->rbparent;
+            }
+            parent->rbred = 0;
+            gp->rbred = 1;
+            rb_rotate_right(t, gp);
+        }
+        else
+        {
+            uncle = gp->rbleft;
+            if (rb_isred(uncle))
+            {
+                parent->rbred = 0;
+                uncle->rbred = 0;
+                gp->rbred = 1;
+                p = gp;
+                continue;
+            }
+            if (p == parent->rbleft)
+            {
+                p = parent;
+                rb_rotate_right(t, p);
+                parent = p->rbparent;
+            }
+            parent->rbred = 0;
+            gp->rbred = 1;
+            rb_rotate_left(t, gp);
+        }
+    }
+    t->root->rbred = 0;
 }
 
-struct proc_node *pop(struct proc_node *head)
+// process after p in tree order (0 if p is the last)
+static struct proc *rb_next(struct proc *p)
 {
-    if (head == 0)
-        return 0;
+    if (p->rbright)
+    {
+        p = p->rbright;
+        while (p->rbleft)
+            p = p->rbleft;
+        return p;
+    }
+    while (p->rbparent && p == p->rbparent->rbright)
+        p = p->rbparent;
+    return p->rbparent;
+}
 
-    struct proc_node *t = head->next;
-    q_free(head);
-    return t;
+// put subtree v where subtree u was
+static void rb_transplant(struct proc_rbtree *t, struct proc *u, struct proc *v)
+{
+    if (u->rbparent == 0)
+        t->root = v;
+    else if (u == u->rbparent->rbleft)
+        u->rbparent->rbleft = v;
+    else
+        u->rbparent->rbright = v;
+    if (v)
+        v->rbparent = u->rbparent;
+}
+
+void rb_remove(struct proc_rbtree *t, struct proc *p)
+{
+    struct proc *y, *x, *parent, *w;
+    int red = p->rbred;
+
+    if (t->leftmost == p)
+        t->leftmost = rb_next(p);
+
+    if (p->rbleft == 0)
+    {
+        x = p->rbright;
+        parent = p->rbparent;
+        rb_transplant(t, p, x);
+    }
+    else if (p->rbright == 0)
+    {
+        x = p->rbleft;
+        parent = p->rbparent;
+        rb_transplant(t, p, x);
+    }
+    else
+    {
+        // replace p by its successor y
+        y = p->rbright;
+        while (y->rbleft)
+            y = y->rbleft;
+        red = y->rbred;
+        x = y->rbright;
+        if (y->rbparent == p)
+            parent = y;
+        else
+        {
+            parent = y->rbparent;
+            rb_transplant(t, y, x);
+            y->rbright = p->rbright;
+            y->rbright->rbparent = y;
+        }
+        rb_transplant(t, p, y);
+        y->rbleft = p->rbleft;
+        y->rbleft->rbparent = y;
+        y->rbred = p->rbred;
+    }
+
+    p->rbparent = p->rbleft = p->rbright = 0;
+    if (red)
+        return;
+
+    // a black node went away: x carries an extra black
+    while (x != t->root && !rb_isred(x))
+    {
+        if (x == parent->rbleft)
+        {
+            w = parent->rbright;
+            if (w->rbred)
+            {
+                w->rbred = 0;
+                parent->rbred = 1;
+                rb_rotate_left(t, parent);
+                w = parent->rbright;
+            }
+            if (!rb_isred(w->rbleft) && !rb_isred(w->rbright))
+            {
+                w->rbred = 1;
+                x = parent;
+                parent = x->rbparent;
+                continue;
+            }
+            if (!rb_isred(w->rbright))
+            {
+                w->rbleft->rbred = 0;
+                w->rbred = 1;
+                rb_rotate_right(t, w);
+                w = parent->rbright;
+            }
+            w->rbred = parent->rbred;
+            parent->rbred = 0;
+            w->rbright->rbred = 0;
+            rb_rotate_left(t, parent);
+        }
+        else
+        {
+            w = parent->rbleft;
+            if (w->rbred)
+            {
+                w->rbred = 0;
+                parent->rbred = 1;
+                rb_rotate_right(t, parent);
+                w = parent->rbleft;
+            }
+            if (!rb_isred(w->rbleft) && !rb_isred(w->rbright))
+            {
+                w->rbred = 1;
+                x = parent;
+                parent = x->rbparent;
+                continue;
+            }
+            if (!rb_isred(w->rbleft))
+            {
+                w->rbright->rbred = 0;
+                w->rbred = 1;
+                rb_rotate_left(t, w);
+                w = parent->rbleft;
+            }
+            w->rbred = parent->rbred;
+            parent->rbred = 0;
+            w->rbleft->rbred = 0;
+            rb_rotate_right(t, parent);
+        }
+        x = t->root;
+    }
+    if (x)
+        x->rbred = 0;
 }
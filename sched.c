@@ -0,0 +1,666 @@
+// Scheduling classes and per-CPU run queues.
+//
+// Each policy (RR, FCFS, PBS, MLFQ, CFS, STRIDE, LOTTERY) is a struct
+// sched_class of hooks; the active one is picked at boot from SCHEDULER and can be
+// replaced at run time with set_scheduler().  proc.c only queues and
+// dequeues processes through the functions at the bottom of this file.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "traps.h"
+
+// Per-CPU run queue. Every RUNNABLE process sits on exactly one of
+// these (runqs[p->cpu]): in the heap under FCFS, in the tree under
+// CFS, otherwise in the FIFO of its level. The exception is a process
+// a cpu has just taken off to run, until that cpu gets ptable.lock.
+// rq->lock alone protects a run queue and the got_queue of the
+// processes on it: cpus pick and steal work without ptable.lock.
+// Lock order is ptable.lock, then rq->lock; nrunnable may be peeked
+// without any lock as a hint.
+struct runq
+{
+    struct spinlock lock;
+    volatile int nrunnable;              // processes queued here
+    uint bitmap[(NLEVEL + 31) / 32];     // bit i set iff queues[i] is non-empty
+    struct proc_queue queues[NLEVEL];    // one FIFO per level
+    struct proc_heap heap;               // FCFS: processes by creation time
+    struct proc_rbtree tree;             // CFS: processes by vruntime
+    uint min_vruntime;                   // CFS: vruntime of the last process picked
+    struct proc_heap stride;             // STRIDE: processes by pass
+    uint min_pass;                       // STRIDE: pass of the last process picked
+    int tickets;                         // LOTTERY: tickets of the processes queued
+    uint seed;                           // LOTTERY: random number state
+    struct proc_heap edf;                // deadline processes by deadline
+    struct proc_queue throttled;         // deadline processes out of runtime
+};
+
+// Deadline processes (p->dl_period != 0) are scheduled earliest
+// deadline first ahead of whatever policy is current: they sit in
+// rq->edf rather than in the class's queues, and the class only sees
+// the rest. A deadline process gets dl_runtime ticks every dl_period
+// ticks; once it has used them it waits on rq->throttled, not counted
+// in nrunnable, until its deadline starts the next period.
+
+// A scheduling policy. enqueue, dequeue and pick are called with
+// rq->lock held; tick and preempt are called on the
+// running process from the timer interrupt.
+struct sched_class
+{
+    char *name;
+    void (*enqueue)(struct runq *, struct proc *); // add p to rq
+    void (*dequeue)(struct runq *, struct proc *); // take p off rq
+    struct proc *(*pick)(struct runq *);           // next process to run, left queued
+    void (*tick)(struct proc *);                   // account a tick of run time, may be 0
+    int (*preempt)(struct proc *);                 // non-zero if p should yield now
+};
+
+static struct runq runqs[NCPU];
+
+static struct sched_class sched_classes[NSCHED];
+static struct sched_class *sched_class = &sched_classes[SCHEDULER];
+
+// FCFS order: earliest created first, lower pid on ties
+static int fcfs_before(struct proc *a, struct proc *b)
+{
+    return a->ctime < b->ctime || (a->ctime == b->ctime && a->pid < b->pid);
+}
+
+// CFS order: smallest vruntime first, lower pid on ties.
+// Compared as a signed difference so wraparound is harmless.
+static int cfs_before(struct proc *a, struct proc *b)
+{
+    int d = a->vruntime - b->vruntime;
+
+    return d < 0 || (d == 0 && a->pid < b->pid);
+}
+
+// EDF order: earliest deadline first, lower pid on ties
+static int edf_before(struct proc *a, struct proc *b)
+{
+    int d = a->dl_deadline - b->dl_deadline;
+
+    return d < 0 || (d == 0 && a->pid < b->pid);
+}
+
+// STRIDE order: smallest pass first, lower pid on ties
+static int stride_before(struct proc *a, struct proc *b)
+{
+    int d = a->pass - b->pass;
+
+    return d < 0 || (d == 0 && a->pid < b->pid);
+}
+
+// CFS weight of each nice level from -20 to 19 (the Linux table):
+// one level apart is roughly 10% of cpu time
+static const int cfs_weights[40] = {
+    88761, 71755, 56483, 46273, 36291,
+    29154, 23254, 18705, 14949, 11916,
+    9548, 7620, 6100, 4904, 3906,
+    3121, 2501, 1991, 1586, 1277,
+    1024, 820, 655, 526, 423,
+    335, 272, 215, 172, 137,
+    110, 87, 70, 56, 45,
+    36, 29, 23, 18, 15,
+};
+
+// CFS weight of p: the default priority 60 is nice 0 and
+// every 2 priority points are one nice level
+static int cfs_weight(struct proc *p)
+{
+    int nice = (p->priority - 60) / 2;
+
+    if (nice < -20)
+        nice = -20;
+    if (nice > 19)
+        nice = 19;
+    return cfs_weights[nice + 20];
+}
+
+void sched_init(void)
+{
+    for (struct runq *rq = runqs; rq < &runqs[NCPU]; rq++)
+    {
+        initlock(&rq->lock, "runq");
+        rq->nrunnable = 0;
+        memset(rq->bitmap, 0, sizeof(rq->bitmap));
+        for (int i = 0; i < NLEVEL; i++)
+            q_init(&rq->queues[i]);
+        heap_init(&rq->heap, fcfs_before);
+        rb_init(&rq->tree, cfs_before);
+        rq->min_vruntime = 0;
+        heap_init(&rq->stride, stride_before);
+        rq->min_pass = 0;
+        rq->tickets = 0;
+        rq->seed = rq - runqs + 1;
+        heap_init(&rq->edf, edf_before);
+        q_init(&rq->throttled);
+    }
+}
+
+// Start a new period for deadline process p if its deadline has
+// passed. If p wanted the cpu all along (wanted) and still did not
+// get its runtime, that is a deadline miss.
+static void dl_update(struct proc *p, int wanted)
+{
+    if ((int)(ticks - p->dl_deadline) < 0)
+        return;
+    if (wanted && p->dl_used < p->dl_runtime)
+        p->dl_misses++;
+    p->dl_deadline = ticks + p->dl_period;
+    p->dl_used = 0;
+}
+
+// queue p on rq under the current class
+static void rq_push(struct runq *rq, struct proc *p)
+{
+    p->got_queue = 1;
+    p->cticks = 0;
+    p->talloc = ticks;
+    if (p->dl_period == 0)
+        sched_class->enqueue(rq, p);
+    else
+    {
+        dl_update(p, 0);
+        if (p->dl_used >= p->dl_runtime)
+        {
+            p->dl_throttled = 1;
+            q_push(&rq->throttled, p);
+            return;
+        }
+        heap_push(&rq->edf, p);
+    }
+    rq->nrunnable++;
+}
+
+// take p off rq
+static void rq_remove(struct runq *rq, struct proc *p)
+{
+    p->got_queue = 0;
+    if (p->dl_period == 0)
+        sched_class->dequeue(rq, p);
+    else if (p->dl_throttled)
+    {
+        p->dl_throttled = 0;
+        q_remove(&rq->throttled, p);
+        return;
+    }
+    else
+        heap_remove(&rq->edf, p);
+    rq->nrunnable--;
+}
+
+//PAGEBREAK: 30
+// Level queues, shared by RR (level 0), PBS (level = priority)
+// and MLFQ (level = queue).
+
+static void level_push(struct runq *rq, struct proc *p, int level)
+{
+    q_push(&rq->queues[level], p);
+    rq->bitmap[level / 32] |= 1 << (level % 32);
+}
+
+static void level_remove(struct runq *rq, struct proc *p, int level)
+{
+    q_remove(&rq->queues[level], p);
+    if (rq->queues[level].head == 0)
+        rq->bitmap[level / 32] &= ~(1 << (level % 32));
+}
+
+// head of the lowest non-empty level of rq, or 0 if rq is empty.
+// Levels are kept in arrival order.
+static struct proc *level_first(struct runq *rq)
+{
+    for (int i = 0; i < NELEM(rq->bitmap); i++)
+    {
+        if (rq->bitmap[i])
+            return rq->queues[i * 32 + __builtin_ctz(rq->bitmap[i])].head;
+    }
+    return 0;
+}
+
+static int always_preempt(struct proc *p)
+{
+    return 1;
+}
+
+static int never_preempt(struct proc *p)
+{
+    return 0;
+}
+
+// RR: one FIFO, preempted every tick
+
+static void rr_enqueue(struct runq *rq, struct proc *p)
+{
+    level_push(rq, p, 0);
+}
+
+static void rr_dequeue(struct runq *rq, struct proc *p)
+{
+    level_remove(rq, p, 0);
+}
+
+// FCFS: earliest created process runs until it blocks or exits
+
+static void fcfs_enqueue(struct runq *rq, struct proc *p)
+{
+    heap_push(&rq->heap, p);
+}
+
+static void fcfs_dequeue(struct runq *rq, struct proc *p)
+{
+    heap_remove(&rq->heap, p);
+}
+
+static struct proc *fcfs_pick(struct runq *rq)
+{
+    return heap_min(&rq->heap);
+}
+
+// PBS: lowest priority value first, round robin within a priority
+
+static void pbs_enqueue(struct runq *rq, struct proc *p)
+{
+    level_push(rq, p, p->priority);
+}
+
+static void pbs_dequeue(struct runq *rq, struct proc *p)
+{
+    level_remove(rq, p, p->priority);
+}
+
+static struct proc *pbs_pick(struct runq *rq)
+{
+    struct proc *p = level_first(rq);
+
+    if (p)
+        p->timeslices++;
+    return p;
+}
+
+// MLFQ: NQUE queues, queue i has a slice of 1 << i ticks; using up
+// the slice demotes a process and waiting AGE_THERSH ticks promotes it
+
+static void mlfq_enqueue(struct runq *rq, struct proc *p)
+{
+    level_push(rq, p, p->queue);
+}
+
+static void mlfq_dequeue(struct runq *rq, struct proc *p)
+{
+    level_remove(rq, p, p->queue);
+}
+
+static struct proc *mlfq_pick(struct runq *rq)
+{
+    // each queue is in talloc order, so aging only has to
+    // look at the heads: age >= AGE_THRESH
+    for (int i = 1; i < NQUE; i++)
+    {
+        struct proc *p;
+
+        while ((p = rq->queues[i].head) != 0 && (ticks - p->talloc) >= AGE_THERSH)
+        {
+            rq_remove(rq, p);
+            p->queue--;
+            rq_push(rq, p);
+#ifdef DEBUG
+            cprintf("UPGRADING [%d] to [%d]\n", p->pid, p->queue);
+#endif
+        }
+    }
+    return level_first(rq);
+}
+
+// accounting: the tick that uses up p's slice demotes it and
+// starts counting the ticks of its next slice from 0
+static void mlfq_tick(struct proc *p)
+{
+    p->q_ticks[p->queue]++;
+    if (p->cticks < (1 << p->queue))
+        return;
+#ifdef DEBUG
+    cprintf("PROCESS %d yeilding queue %d\n", p->pid, p->queue);
+#endif
+    if (p->queue != NQUE - 1)
+        p->queue++;
+    p->cticks = 0;
+}
+
+// decision only: preempt once mlfq_tick has ended p's slice
+static int mlfq_preempt(struct proc *p)
+{
+    return p->cticks == 0;
+}
+
+// CFS: least weighted run time (vruntime) first
+
+static void cfs_enqueue(struct runq *rq, struct proc *p)
+{
+    // a new or long sleeping process gets at most one granularity
+    // of credit over the processes already queued
+    uint floor = rq->min_vruntime - CFS_GRANULARITY * NICE_0_WEIGHT;
+
+    if ((int)(p->vruntime - floor) < 0)
+        p->vruntime = floor;
+    rb_insert(&rq->tree, p);
+}
+
+static void cfs_dequeue(struct runq *rq, struct proc *p)
+{
+    rb_remove(&rq->tree, p);
+}
+
+static struct proc *cfs_pick(struct runq *rq)
+{
+    struct proc *p = rq->tree.leftmost;
+
+    if (p && (int)(p->vruntime - rq->min_vruntime) > 0)
+        rq->min_vruntime = p->vruntime;
+    return p;
+}
+
+static void cfs_tick(struct proc *p)
+{
+    p->vruntime += NICE_0_WEIGHT * 1024 / cfs_weight(p);
+}
+
+// preempt once p has run CFS_GRANULARITY ticks and some queued
+// process on its cpu has a smaller vruntime
+static int cfs_preempt(struct proc *p)
+{
+    struct runq *rq = &runqs[p->cpu];
+    struct proc *next;
+    int preempt = 0;
+
+    if (p->cticks < CFS_GRANULARITY)
+        return 0;
+
+    acquire(&rq->lock);
+    next = rq->tree.leftmost;
+    if (next && cfs_before(next, p))
+        preempt = 1;
+    release(&rq->lock);
+    return preempt;
+}
+
+// STRIDE: proportional share; each tick of run time advances a
+// process's pass by STRIDE1 / tickets and the smallest pass runs next
+
+static void stride_enqueue(struct runq *rq, struct proc *p)
+{
+    // like CFS, a process coming back from sleep may not
+    // claim the time it spent away
+    if ((int)(p->pass - rq->min_pass) < 0)
+        p->pass = rq->min_pass;
+    heap_push(&rq->stride, p);
+}
+
+static void stride_dequeue(struct runq *rq, struct proc *p)
+{
+    heap_remove(&rq->stride, p);
+}
+
+static struct proc *stride_pick(struct runq *rq)
+{
+    struct proc *p = heap_min(&rq->stride);
+
+    if (p && (int)(p->pass - rq->min_pass) > 0)
+        rq->min_pass = p->pass;
+    return p;
+}
+
+static void stride_tick(struct proc *p)
+{
+    p->pass += STRIDE1 / p->tickets;
+}
+
+// LOTTERY: proportional share by random draw, a fallback for STRIDE
+// that keeps no per-process history
+
+static void lottery_enqueue(struct runq *rq, struct proc *p)
+{
+    level_push(rq, p, 0);
+    rq->tickets += p->tickets;
+}
+
+static void lottery_dequeue(struct runq *rq, struct proc *p)
+{
+    level_remove(rq, p, 0);
+    rq->tickets -= p->tickets;
+}
+
+static struct proc *lottery_pick(struct runq *rq)
+{
+    struct proc *p;
+    int winner;
+
+    if (rq->tickets <= 0)
+        return rq->queues[0].head;
+
+    // xorshift32
+    rq->seed ^= rq->seed << 13;
+    rq->seed ^= rq->seed >> 17;
+    rq->seed ^= rq->seed << 5;
+    winner = rq->seed % rq->tickets;
+
+    for (p = rq->queues[0].head; p->qnext; p = p->qnext)
+    {
+        if ((winner -= p->tickets) < 0)
+            break;
+    }
+    return p;
+}
+
+static struct sched_class sched_classes[NSCHED] = {
+    [RR] {"RR", rr_enqueue, rr_dequeue, level_first, 0, always_preempt},
+    [FCFS] {"FCFS", fcfs_enqueue, fcfs_dequeue, fcfs_pick, 0, never_preempt},
+    [PBS] {"PBS", pbs_enqueue, pbs_dequeue, pbs_pick, 0, always_preempt},
+    [MLFQ] {"MLFQ", mlfq_enqueue, mlfq_dequeue, mlfq_pick, mlfq_tick, mlfq_preempt},
+    [CFS] {"CFS", cfs_enqueue, cfs_dequeue, cfs_pick, cfs_tick, cfs_preempt},
+    [STRIDE] {"STRIDE", stride_enqueue, stride_dequeue, stride_pick, stride_tick, always_preempt},
+    [LOTTERY] {"LOTTERY", lottery_enqueue, lottery_dequeue, lottery_pick, 0, always_preempt},
+};
+
+//PAGEBREAK: 30
+// Interface used by proc.c and trap.c.
+
+// Wake a halted cpu to run work just queued on runqs[cpu]: that
+// cpu if it is idle, otherwise any idle one so it can steal it.
+static void kick_idle(int cpu)
+{
+    struct cpu *me = mycpu();
+    struct cpu *c = &cpus[cpu];
+
+    if (!c->idle)
+    {
+        for (c = cpus; c < &cpus[ncpu]; c++)
+            if (c->idle && c != me)
+                break;
+        if (c == &cpus[ncpu])
+            return;
+    }
+    if (c != me)
+        lapicipi(c->apicid, T_IRQ0 + IRQ_WAKE);
+}
+
+// push the process in p->queue of the run queue of
+// the cpu it last ran on (ptable must be held)
+void push_process(struct proc *p)
+{
+    struct runq *rq = &runqs[p->cpu];
+    int pushed = 0;
+
+    acquire(&rq->lock);
+    if (p->got_queue == 0)
+    {
+        rq_push(rq, p);
+        pushed = 1;
+    }
+    release(&rq->lock);
+    if (pushed)
+        kick_idle(p->cpu);
+}
+
+// take p off its run queue if it is on one (ptable must be held)
+void remove_process(struct proc *p)
+{
+    struct runq *rq = &runqs[p->cpu];
+
+    acquire(&rq->lock);
+    if (p->got_queue)
+        rq_remove(rq, p);
+    release(&rq->lock);
+}
+
+// Run queue CPU c should take its next process from: its own if it
+// has work, otherwise the busiest peer's (work stealing).
+// Only peeks at queue lengths, so it takes no locks.
+static struct runq *
+find_runq(struct cpu *c)
+{
+    struct runq *rq = &runqs[c - cpus];
+    struct runq *busiest = 0;
+
+    if (rq->nrunnable > 0)
+        return rq;
+
+    for (rq = runqs; rq < &runqs[ncpu]; rq++)
+    {
+        if (rq->nrunnable > (busiest ? busiest->nrunnable : 0))
+            busiest = rq;
+    }
+    return busiest;
+}
+
+// non-zero if some run queue has work for c; a lockless hint
+int sched_runnable(struct cpu *c)
+{
+    return find_runq(c) != 0;
+}
+
+// Remove and return the process c should run next under the
+// current policy, or 0 if another cpu took it first.
+// Takes only the run queue's lock, not ptable.lock, so cpus do
+// not contend unless they pick from the same queue. Until the
+// caller has ptable.lock and has checked that p is still
+// RUNNABLE and off every queue, p may be queued again by
+// set_priority and the like and run by another cpu.
+struct proc *
+sched_dequeue(struct cpu *c)
+{
+    struct runq *rq;
+    struct proc *p = 0;
+
+    if ((rq = find_runq(c)) == 0)
+        return 0;
+
+    acquire(&rq->lock);
+    if ((p = heap_min(&rq->edf)) != 0 || (p = sched_class->pick(rq)) != 0)
+    {
+        rq_remove(rq, p);
+        // it has been waiting, so a deadline passed meanwhile is a miss
+        if (p->dl_period)
+            dl_update(p, 1);
+    }
+    release(&rq->lock);
+    return p;
+}
+
+// Move p, taken off runqs[p->cpu], over to cpu. Its CFS vruntime
+// and STRIDE pass are carried over relative to the minimum of each
+// queue, so that it neither starves the processes of its new queue
+// nor is starved by them. ptable.lock must be held.
+void sched_migrate(struct proc *p, int cpu)
+{
+    struct runq *from = &runqs[p->cpu];
+    struct runq *to = &runqs[cpu];
+
+    if (from == to)
+        return;
+    p->vruntime += to->min_vruntime - from->min_vruntime;
+    p->pass += to->min_pass - from->min_pass;
+    p->cpu = cpu;
+}
+
+// Account a timer tick to the running process p.
+// Returns non-zero if p should give up the cpu.
+int sched_tick(struct proc *p)
+{
+    struct sched_class *sc = sched_class;
+    struct runq *rq = &runqs[p->cpu];
+    struct proc *next;
+    int preempt;
+
+    p->cticks++;
+    if (p->dl_period)
+    {
+        p->dl_used++;
+        dl_update(p, 1);
+        if (p->dl_used >= p->dl_runtime)
+            return 1;
+
+        // a queued process with an earlier deadline goes first
+        acquire(&rq->lock);
+        next = heap_min(&rq->edf);
+        preempt = next && edf_before(next, p);
+        release(&rq->lock);
+        return preempt;
+    }
+
+    if (sc->tick)
+        sc->tick(p);
+    // deadline processes go ahead of the current policy
+    if (rq->edf.n > 0)
+        return 1;
+    return sc->preempt(p);
+}
+
+// Move deadline processes whose period is over from the throttled
+// lists back to their run queues, with their runtime restored.
+// Called on every tick by cpu 0.
+void sched_release(void)
+{
+    struct runq *rq;
+    struct proc *p, *next;
+
+    for (rq = runqs; rq < &runqs[ncpu]; rq++)
+    {
+        if (rq->throttled.head == 0)
+            continue;
+        acquire(&rq->lock);
+        for (p = rq->throttled.head; p; p = next)
+        {
+            next = p->qnext;
+            if ((int)(ticks - p->dl_deadline) < 0)
+                continue;
+            q_remove(&rq->throttled, p);
+            p->dl_throttled = 0;
+            p->dl_deadline += p->dl_period;
+            p->dl_used = 0;
+            heap_push(&rq->edf, p);
+            rq->nrunnable++;
+            kick_idle(rq - runqs);
+        }
+        release(&rq->lock);
+    }
+}
+
+// Make policy the current one. Every queued process must have been
+// taken off its run queue first (ptable must be held).
+// Returns the previous policy, or -1 if policy is not valid.
+int sched_setclass(int policy)
+{
+    int old = sched_class - sched_classes;
+
+    if (policy < 0 || policy >= NSCHED)
+        return -1;
+    sched_class = &sched_classes[policy];
+    return old;
+}
@@ -0,0 +1,35 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+// same order as the policy numbers in proc.h
+static char *policies[] = {"RR", "FCFS", "PBS", "MLFQ", "CFS", "STRIDE", "LOTTERY"};
+
+int main(int argc, char **argv)
+{
+    int policy, old;
+
+    if (argc != 2)
+    {
+        printf(2, "Wrong format for setScheduler; Usage setScheduler RR|FCFS|PBS|MLFQ|CFS|STRIDE|LOTTERY\n");
+        exit();
+    }
+
+    policy = -1;
+    for (int i = 0; i < sizeof(policies) / sizeof(policies[0]); i++)
+    {
+        if (strcmp(argv[1], policies[i]) == 0)
+            policy = i;
+    }
+    if (policy < 0 && argv[1][0] >= '0' && argv[1][0] <= '9')
+        policy = atoi(argv[1]);
+
+    old = set_scheduler(policy);
+    if (old == -1)
+    {
+        printf(2, "Invalid scheduling policy %s\n", argv[1]);
+        exit();
+    }
+    printf(1, "%s -> %s\n", policies[old], policies[policy]);
+    exit();
+}
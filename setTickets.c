@@ -0,0 +1,19 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        printf(2, "Wrong format for setTickets; Usage setTickets tickets pid\n");
+        exit();
+    }
+
+    int _ret = settickets(atoi(argv[1]), atoi(argv[2]));
+    if (_ret == -1)
+    {
+        printf(2, "Invalid tickets or pid\n");
+    }
+    exit();
+}
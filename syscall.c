@@ -20,6 +20,8 @@ int fetchint(uint addr, int *ip)
 
     if (addr >= curproc->sz || addr + 4 > curproc->sz)
         return -1;
+    if (prefaultuvm(curproc, addr, 4, 0) < 0)
+        return -1;
     *ip = *(int *)(addr);
     return 0;
 }
@@ -38,6 +40,8 @@ int fetchstr(uint addr, char **pp)
     ep = (char *)curproc->sz;
     for (s = *pp; s < ep; s++)
     {
+        if ((s == *pp || (uint)s % PGSIZE == 0) && prefaultuvm(curproc, (uint)s, 1, 0) < 0)
+            return -1;
         if (*s == 0)
             return s - *pp;
     }
@@ -50,10 +54,7 @@ int argint(int n, int *ip)
     return fetchint((myproc()->tf->esp) + 4 + 4 * n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int argptr(int n, char **pp, int size)
+static int argbuf(int n, char **pp, int size, int write)
 {
     int i;
     struct proc *curproc = myproc();
@@ -62,10 +63,30 @@ int argptr(int n, char **pp, int size)
         return -1;
     if (size < 0 || (uint)i >= curproc->sz || (uint)i + size > curproc->sz)
         return -1;
+    if (prefaultuvm(curproc, i, size, write) < 0)
+        return -1;
     *pp = (char *)i;
     return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size bytes.  Check that the pointer
+// lies within the process address space, and fault the block in
+// now: system calls may use it with locks held, when a page
+// fault must not have to read from disk.
+int argptr(int n, char **pp, int size)
+{
+    return argbuf(n, pp, size, 0);
+}
+
+// Like argptr, for a block the system call writes to: break
+// copy-on-write on it now too, since the kernel cannot recover
+// if that fails in the middle of its own write.
+int argptrw(int n, char **pp, int size)
+{
+    return argbuf(n, pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
 // (There is no shared writable memory, so the string can't change
@@ -102,6 +123,11 @@ extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_set_priority(void);
 extern int sys_ps(void);
+extern int sys_set_scheduler(void);
+extern int sys_settickets(void);
+extern int sys_sched_deadline(void);
+extern int sys_fsync(void);
+extern int sys_splice(void);
 
 static int (*syscalls[])(void) = {
     [SYS_fork] sys_fork,
@@ -128,6 +154,11 @@ static int (*syscalls[])(void) = {
     [SYS_close] sys_close,
     [SYS_set_priority] sys_set_priority,
     [SYS_ps] sys_ps,
+    [SYS_set_scheduler] sys_set_scheduler,
+    [SYS_settickets] sys_settickets,
+    [SYS_sched_deadline] sys_sched_deadline,
+    [SYS_fsync] sys_fsync,
+    [SYS_splice] sys_splice,
 };
 
 void syscall(void)
@@ -23,3 +23,8 @@
 #define SYS_waitx 22
 #define SYS_set_priority 23
 #define SYS_ps 24
+#define SYS_set_scheduler 25
+#define SYS_settickets 26
+#define SYS_sched_deadline 27
+#define SYS_fsync 28
+#define SYS_splice 29
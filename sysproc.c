@@ -6,6 +6,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "spinlock.h"
+#include "timer.h"
 
 int sys_fork(void)
 {
@@ -26,10 +28,10 @@ int sys_wait(void)
 int sys_waitx(void)
 {
     int *wtime, *rtime;
-    if (argptr(0, (void *)&wtime, 8) < 0)
+    if (argptrw(0, (void *)&wtime, 8) < 0)
         return -1;
 
-    if (argptr(1, (void *)&rtime, 8) < 0)
+    if (argptrw(1, (void *)&rtime, 8) < 0)
         return -1;
 
     return waitx(wtime, rtime);
@@ -52,6 +54,39 @@ int sys_set_priority(void)
     return set_priority(priority, pid);
 }
 
+int sys_set_scheduler(void)
+{
+    int policy;
+    if (argint(0, &policy) < 0)
+        return -1;
+
+    return set_scheduler(policy);
+}
+
+int sys_settickets(void)
+{
+    int tickets, pid;
+    if (argint(0, &tickets) < 0)
+        return -1;
+
+    if (argint(1, &pid) < 0)
+        return -1;
+
+    return settickets(tickets, pid);
+}
+
+int sys_sched_deadline(void)
+{
+    int runtime, period;
+    if (argint(0, &runtime) < 0)
+        return -1;
+
+    if (argint(1, &period) < 0)
+        return -1;
+
+    return sched_deadline(runtime, period);
+}
+
 int sys_kill(void)
 {
     int pid;
@@ -82,20 +117,29 @@ int sys_sbrk(void)
 int sys_sleep(void)
 {
     int n;
-    uint ticks0;
+    struct timer t;
 
     if (argint(0, &n) < 0)
         return -1;
+    if (n <= 0)
+        return 0;
     acquire(&tickslock);
-    ticks0 = ticks;
-    while (ticks - ticks0 < n)
+    // sleep until our own timer goes off instead of
+    // being woken on every tick
+    t.expires = ticks + n;
+    t.fn = wakeup;
+    t.arg = &t;
+    t.pending = 0;
+    timer_add(&t);
+    while (t.pending)
     {
         if (myproc()->killed)
         {
+            timer_del(&t);
             release(&tickslock);
             return -1;
         }
-        sleep(&ticks, &tickslock);
+        sleep(&t, &tickslock);
     }
     release(&tickslock);
     return 0;
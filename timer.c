@@ -0,0 +1,147 @@
+// Hierarchical timer wheel.
+//
+// Pending timers hang off TW_LEVELS wheels of TW_SIZE slots. Level 0
+// has a slot for each of the next TW_SIZE ticks, and every slot of
+// level l covers TW_SIZE^l ticks. Each time level 0 comes round, the
+// next slot of level 1 is cascaded: its timers are added again and
+// spread over level 0, and likewise further up. Adding or deleting a
+// timer is O(1), and a tick only looks at the timers expiring in it
+// plus, once every TW_SIZE ticks, the slot being cascaded.
+//
+// The wheel is protected by tickslock. Timers run from the timer
+// interrupt on cpu 0 with tickslock held.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "timer.h"
+
+#define TW_BITS 6
+#define TW_SIZE (1 << TW_BITS)
+#define TW_MASK (TW_SIZE - 1)
+#define TW_LEVELS 4
+#define TW_MAX ((1u << (TW_BITS * TW_LEVELS)) - 1) // furthest tick a slot can hold
+
+static struct timer *wheel[TW_LEVELS][TW_SIZE];
+static uint tw_now;  // next tick to be run
+static int tw_count; // timers on the wheel
+
+// link t into the slot for t->expires, relative to tw_now
+static void tw_insert(struct timer *t)
+{
+    uint delta = t->expires - tw_now;
+    uint e = t->expires;
+    struct timer **slot;
+    int l;
+
+    if ((int)delta < 0)
+    {
+        // already due: run it at the next tick
+        delta = 0;
+        e = tw_now;
+    }
+    else if (delta > TW_MAX)
+    {
+        // too far out: park it as far as the wheel reaches, it
+        // is placed again when that slot is cascaded
+        delta = TW_MAX;
+        e = tw_now + TW_MAX;
+    }
+
+    for (l = 0; l < TW_LEVELS - 1; l++)
+    {
+        if (delta < (1u << (TW_BITS * (l + 1))))
+            break;
+    }
+    slot = &wheel[l][(e >> (TW_BITS * l)) & TW_MASK];
+
+    t->next = *slot;
+    if (t->next)
+        t->next->pprev = &t->next;
+    t->pprev = slot;
+    *slot = t;
+}
+
+static void tw_unlink(struct timer *t)
+{
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    t->next = 0;
+    t->pprev = 0;
+}
+
+// Spread the current slot of level l over the lower levels.
+// Returns the slot index, so the caller knows level l wrapped if 0.
+static int cascade(int l)
+{
+    int idx = (tw_now >> (TW_BITS * l)) & TW_MASK;
+    struct timer *t, *next;
+
+    t = wheel[l][idx];
+    wheel[l][idx] = 0;
+    for (; t; t = next)
+    {
+        next = t->next;
+        tw_insert(t);
+    }
+    return idx;
+}
+
+// Call t->fn(t->arg) once ticks reaches t->expires.
+// tickslock must be held.
+void timer_add(struct timer *t)
+{
+    if (t->pending)
+        panic("timer_add");
+    t->pending = 1;
+    tw_count++;
+    tw_insert(t);
+}
+
+// Take t off the wheel if it has not run yet.
+// tickslock must be held.
+void timer_del(struct timer *t)
+{
+    if (!t->pending)
+        return;
+    tw_unlink(t);
+    t->pending = 0;
+    tw_count--;
+}
+
+// Run the timers that have expired. Called by cpu 0 on every tick
+// with tickslock held.
+void timer_tick(void)
+{
+    struct timer *t;
+    int idx, l;
+
+    while ((int)(ticks - tw_now) >= 0)
+    {
+        if (tw_count == 0)
+        {
+            // nothing to cascade or run
+            tw_now = ticks + 1;
+            break;
+        }
+
+        idx = tw_now & TW_MASK;
+        if (idx == 0)
+        {
+            for (l = 1; l < TW_LEVELS; l++)
+                if (cascade(l) != 0)
+                    break;
+        }
+
+        while ((t = wheel[0][idx]) != 0)
+        {
+            tw_unlink(t);
+            t->pending = 0;
+            tw_count--;
+            t->fn(t->arg);
+        }
+        tw_now++;
+    }
+}
@@ -0,0 +1,10 @@
+// Timer on the timer wheel (see timer.c)
+struct timer
+{
+    uint expires;          // tick at which fn(arg) is called
+    void (*fn)(void *);    // called from the timer interrupt, tickslock held
+    void *arg;
+    int pending;           // non-zero while on the wheel
+    struct timer *next;    // next timer in the wheel slot
+    struct timer **pprev;  // link pointing at this timer
+};
@@ -51,8 +51,11 @@ void trap(struct trapframe *tf)
         {
             acquire(&tickslock);
             ticks++;
-            upd_ptimes();
-            wakeup(&ticks);
+#ifdef LOGS
+            log_procs();
+#endif
+            sched_release();
+            timer_tick();
             release(&tickslock);
         }
         lapiceoi();
@@ -64,6 +67,10 @@ void trap(struct trapframe *tf)
     case T_IRQ0 + IRQ_IDE + 1:
         // Bochs generates spurious IDE1 interrupts.
         break;
+    case T_IRQ0 + IRQ_WAKE:
+        // another cpu queued work for us, the scheduler will find it
+        lapiceoi();
+        break;
     case T_IRQ0 + IRQ_KBD:
         kbdintr();
         lapiceoi();
@@ -79,6 +86,17 @@ void trap(struct trapframe *tf)
         lapiceoi();
         break;
 
+    case T_PGFLT:
+        // A first touch of a lazily allocated heap page or a write to
+        // a copy-on-write page, from user space or from the kernel
+        // using user memory (CR0_WP is set). System calls fault in
+        // the user memory they use beforehand (argptr, argptrw), so
+        // a kernel fault here cannot fail for lack of memory.
+        if (myproc() && pagefault(myproc(), rcr2(), tf->err) == 0)
+            break;
+        // anything else is an unexpected trap
+        // fall through
+
     //PAGEBREAK: 13
     default:
         if (myproc() == 0 || (tf->cs & 3) == 0)
@@ -102,35 +120,14 @@ void trap(struct trapframe *tf)
     if (myproc() && myproc()->killed && (tf->cs & 3) == DPL_USER)
         exit();
 
-#if (SCHEDULER == RR || SCHEDULER == PBS)
-    // Force process to give up CPU on clock tick.
+    // Give up the CPU if the scheduling policy says this tick ends
+    // the process's slice.
     // If interrupts were on while locks held, would need to check nlock.
-    if (myproc() && myproc()->state == RUNNING && tf->trapno == T_IRQ0 + IRQ_TIMER)
+    if (myproc() && myproc()->state == RUNNING && tf->trapno == T_IRQ0 + IRQ_TIMER &&
+        sched_tick(myproc()))
         yield();
 
     // Check if the process has been killed since we yielded
     if (myproc() && myproc()->killed && (tf->cs & 3) == DPL_USER)
         exit();
-
-#elif (SCHEDULER == MLFQ)
-
-    if (myproc() && myproc()->state == RUNNING && tf->trapno == T_IRQ0 + IRQ_TIMER)
-    {
-        if (myproc()->cticks >= (1 << (myproc()->queue)))
-        {
-#ifdef DEBUG
-            cprintf("PROCESS %d yeilding queue %d\n", myproc()->pid, myproc()->queue);
-#endif
-            yield();
-        }
-        else
-        {
-            inc_cticks(myproc());
-        }
-    }
-
-    if (myproc() && myproc()->killed && (tf->cs & 3) == DPL_USER)
-        exit();
-
-#endif
 }
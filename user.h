@@ -26,6 +26,11 @@ int sleep(int);
 int uptime(void);
 int set_priority(int, int);
 int ps(void);
+int set_scheduler(int);
+int settickets(int, int);
+int sched_deadline(int, int);
+int fsync(int);
+int splice(int, int, int);
 
 // ulib.c
 int stat(const char *, struct stat *);
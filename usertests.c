@@ -354,6 +354,130 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// splice moves data between a file and a pipe in the kernel. does
+// it stop short at the end of the file and of the pipe, and give
+// up on a pipe nobody reads?
+void
+splicetest(void)
+{
+  int fd, fd1, fds[2], i, n, cc;
+
+  printf(stdout, "splice test\n");
+  unlink("splicein");
+  unlink("spliceout");
+  fd = open("splicein", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "splice test: cannot create splicein\n");
+    exit();
+  }
+  for(i = 0; i < 1000; i++)
+    buf[i] = i % 251;
+  if(write(fd, buf, 1000) != 1000){
+    printf(stdout, "splice test: write failed\n");
+    exit();
+  }
+  close(fd);
+
+  // file to pipe, asking for more than the file has
+  fd = open("splicein", 0);
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  if((n = splice(fd, fds[1], 4096)) != 1000){
+    printf(stdout, "splice test failed: file to pipe returned %d\n", n);
+    exit();
+  }
+  if(splice(fd, fds[1], 100) != 0){
+    printf(stdout, "splice test failed: file to pipe at end of file\n");
+    exit();
+  }
+  close(fd);
+  close(fds[1]);
+  n = 0;
+  while((cc = read(fds[0], buf + 1024 + n, 1024)) > 0)
+    n += cc;
+  close(fds[0]);
+  for(i = 0; i < 1000; i++){
+    if(buf[1024 + i] != buf[i])
+      break;
+  }
+  if(n != 1000 || i != 1000){
+    printf(stdout, "splice test failed: wrong data from pipe\n");
+    exit();
+  }
+
+  // pipe to file, the pipe holding less than asked for
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  if(write(fds[1], buf, 700) != 700){
+    printf(stdout, "splice test: pipe write failed\n");
+    exit();
+  }
+  close(fds[1]);
+  fd = open("spliceout", O_CREATE|O_RDWR);
+  if((n = splice(fds[0], fd, 1000)) != 700){
+    printf(stdout, "splice test failed: pipe to file returned %d\n", n);
+    exit();
+  }
+  if(splice(fds[0], fd, 1000) != 0){
+    printf(stdout, "splice test failed: pipe to file at end of pipe\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fd);
+  fd = open("spliceout", 0);
+  if(read(fd, buf + 1024, 1000) != 700){
+    printf(stdout, "splice test failed: wrong size of spliceout\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; i < 700; i++){
+    if(buf[1024 + i] != buf[i]){
+      printf(stdout, "splice test failed: wrong data in spliceout\n");
+      exit();
+    }
+  }
+
+  // neither is a pipe
+  fd = open("splicein", 0);
+  fd1 = open("spliceout", O_RDWR);
+  if(splice(fd, fd1, 100) != -1){
+    printf(stdout, "splice test failed: file to file\n");
+    exit();
+  }
+  close(fd);
+  close(fd1);
+
+  // a file bigger than the pipe, into a pipe nobody reads
+  fd = open("splicein", O_RDWR);
+  for(i = 0; i < (PIPEPAGES+1)*8; i++){
+    if(write(fd, buf, 512) != 512){
+      printf(stdout, "splice test: write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  fd = open("splicein", 0);
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  close(fds[0]);
+  if((n = splice(fd, fds[1], (PIPEPAGES+1)*4096)) >= (PIPEPAGES+1)*4096){
+    printf(stdout, "splice test failed: closed reader took %d\n", n);
+    exit();
+  }
+  close(fd);
+  close(fds[1]);
+
+  unlink("splicein");
+  unlink("spliceout");
+  printf(stdout, "splice test ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -1144,6 +1268,65 @@ bigwrite(void)
   printf(1, "bigwrite ok\n");
 }
 
+// fsync waits for the log writer to commit. does it come back,
+// also when several processes ask at once, with the data there?
+void
+fsynctest(void)
+{
+  int fd, i, pid;
+
+  printf(stdout, "fsync test\n");
+  unlink("fsyncfile");
+  fd = open("fsyncfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "fsync test: cannot create fsyncfile\n");
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    memset(buf, 'a' + i, 512);
+    if(write(fd, buf, 512) != 512){
+      printf(stdout, "fsync test: write failed\n");
+      exit();
+    }
+    if(fsync(fd) != 0){
+      printf(stdout, "fsync test failed: fsync returned an error\n");
+      exit();
+    }
+  }
+  close(fd);
+  if(fsync(fd) != -1){
+    printf(stdout, "fsync test failed: fsync of a closed fd\n");
+    exit();
+  }
+
+  for(i = 0; i < 4; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(stdout, "fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      fd = open("fsyncfile", O_RDWR);
+      if(fd < 0 || fsync(fd) != 0)
+        printf(stdout, "fsync test failed: child fsync\n");
+      exit();
+    }
+  }
+  for(i = 0; i < 4; i++)
+    wait();
+
+  fd = open("fsyncfile", 0);
+  for(i = 0; i < 4; i++){
+    if(read(fd, buf, 512) != 512 || buf[0] != 'a' + i || buf[511] != 'a' + i){
+      printf(stdout, "fsync test failed: wrong data\n");
+      exit();
+    }
+  }
+  close(fd);
+  unlink("fsyncfile");
+  printf(stdout, "fsync test ok\n");
+}
+
 void
 bigfile(void)
 {
@@ -1200,6 +1383,59 @@ bigfile(void)
   printf(1, "bigfile test ok\n");
 }
 
+// a file longer than the direct and indirect blocks reach goes
+// through the doubly-indirect block. are all its blocks there,
+// and freed again when it is removed? the file takes half the
+// disk and is written twice, so leaked blocks run balloc out.
+void
+hugefile(void)
+{
+  int fd, i, n, round;
+
+  printf(1, "hugefile test\n");
+  n = FSSIZE / 2;
+  if(n <= NDIRECT + NINDIRECT){
+    printf(1, "hugefile test: FSSIZE too small\n");
+    exit();
+  }
+  for(round = 0; round < 2; round++){
+    unlink("hugefile");
+    fd = open("hugefile", O_CREATE|O_RDWR);
+    if(fd < 0){
+      printf(1, "cannot create hugefile\n");
+      exit();
+    }
+    for(i = 0; i < n; i++){
+      ((int*)buf)[0] = i;
+      if(write(fd, buf, BSIZE) != BSIZE){
+        printf(1, "write hugefile block %d failed\n", i);
+        exit();
+      }
+    }
+    close(fd);
+
+    fd = open("hugefile", 0);
+    if(fd < 0){
+      printf(1, "cannot open hugefile\n");
+      exit();
+    }
+    for(i = 0; i < n; i++){
+      if(read(fd, buf, BSIZE) != BSIZE || ((int*)buf)[0] != i){
+        printf(1, "read hugefile block %d wrong\n", i);
+        exit();
+      }
+    }
+    if(read(fd, buf, BSIZE) != 0){
+      printf(1, "read hugefile past the end\n");
+      exit();
+    }
+    close(fd);
+  }
+  unlink("hugefile");
+
+  printf(1, "hugefile test ok\n");
+}
+
 void
 fourteen(void)
 {
@@ -1411,6 +1647,105 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// after fork, parent and child share their pages copy-on-write.
+// does each see only its own writes, also those the kernel
+// makes for it?
+void
+cowtest(void)
+{
+  int fds[2], pid;
+
+  printf(stdout, "cow test\n");
+  buf[0] = 'p';
+  buf[4096] = 'p';
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[1]);
+    if(buf[0] != 'p'){
+      printf(stdout, "cow test failed: child sees parent's write\n");
+      exit();
+    }
+    buf[0] = 'c';
+    // read() writes the other page, still shared with the parent
+    if(read(fds[0], buf + 4096, 1) != 1 || buf[4096] != 'x'){
+      printf(stdout, "cow test failed: child read\n");
+      exit();
+    }
+    if(buf[0] != 'c'){
+      printf(stdout, "cow test failed: child lost its write\n");
+      exit();
+    }
+    exit();
+  }
+  close(fds[0]);
+  buf[0] = 'q';
+  if(write(fds[1], "x", 1) != 1){
+    printf(stdout, "cow test failed: write\n");
+    exit();
+  }
+  close(fds[1]);
+  wait();
+  if(buf[0] != 'q' || buf[4096] != 'p'){
+    printf(stdout, "cow test failed: parent sees child's write\n");
+    exit();
+  }
+  printf(stdout, "cow test ok\n");
+}
+
+// children that write every page they share with the parent need
+// more memory than there is; those that cannot get a page are
+// killed. does the parent's copy come through intact?
+void
+cowmemtest(void)
+{
+  char *a, *p;
+  int i, pid;
+
+  printf(stdout, "cow memory test\n");
+#define COWMEM (120*1024*1024)
+  a = sbrk(COWMEM);
+  if(a == (char*)0xffffffff){
+    printf(stdout, "cow memory test: sbrk failed\n");
+    exit();
+  }
+  for(p = a; p < a + COWMEM; p += 4096)
+    *p = 1;
+
+  for(i = 0; i < 3; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(stdout, "cow memory test: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      for(p = a; p < a + COWMEM; p += 4096)
+        *p = 2;
+      exit();
+    }
+    wait();
+  }
+
+  for(p = a; p < a + COWMEM; p += 4096){
+    if(*p != 1){
+      printf(stdout, "cow memory test failed: parent sees child's write\n");
+      exit();
+    }
+  }
+  if(sbrk(-COWMEM) == (char*)0xffffffff){
+    printf(stdout, "cow memory test: sbrk could not deallocate\n");
+    exit();
+  }
+  printf(stdout, "cow memory test ok\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1546,6 +1881,68 @@ sbrktest(void)
   printf(stdout, "sbrk test OK\n");
 }
 
+// sbrk only reserves memory. is a page zero when it is first
+// touched, in any order and also by the kernel, and zero again
+// after the heap shrinks and grows back over it?
+void
+lazysbrktest(void)
+{
+  char *a, *p;
+  int fd, i;
+
+  printf(stdout, "lazy sbrk test\n");
+  // start on a page boundary, so shrinking frees every page
+  if((uint)sbrk(0) % 4096)
+    sbrk(4096 - (uint)sbrk(0) % 4096);
+  a = sbrk(10*4096);
+  if(a == (char*)0xffffffff){
+    printf(stdout, "lazy sbrk test: sbrk failed\n");
+    exit();
+  }
+  // last page first, skipping some
+  for(i = 9; i >= 0; i -= 3){
+    p = a + i*4096;
+    if(*p != 0){
+      printf(stdout, "lazy sbrk test failed: page %d not zero\n", i);
+      exit();
+    }
+    *p = 'a';
+  }
+
+  // read() into a page nothing has touched yet
+  fd = open("init", 0);
+  if(fd < 0){
+    printf(stdout, "lazy sbrk test: open init failed\n");
+    exit();
+  }
+  if(read(fd, a + 4*4096 + 100, 512) != 512){
+    printf(stdout, "lazy sbrk test failed: read\n");
+    exit();
+  }
+  close(fd);
+  if(a[4*4096] != 0){
+    printf(stdout, "lazy sbrk test failed: read page not zero\n");
+    exit();
+  }
+
+  if(sbrk(-10*4096) == (char*)0xffffffff){
+    printf(stdout, "lazy sbrk test: sbrk could not deallocate\n");
+    exit();
+  }
+  if(sbrk(10*4096) != a){
+    printf(stdout, "lazy sbrk test: sbrk did not grow back\n");
+    exit();
+  }
+  for(i = 0; i < 10; i++){
+    if(a[i*4096] != 0 || a[i*4096 + 100] != 0){
+      printf(stdout, "lazy sbrk test failed: page %d not zero after shrink\n", i);
+      exit();
+    }
+  }
+  sbrk(-10*4096);
+  printf(stdout, "lazy sbrk test ok\n");
+}
+
 void
 validateint(int *p)
 {
@@ -1606,6 +2003,85 @@ bsstest(void)
   printf(stdout, "bss test ok\n");
 }
 
+// exec maps a program's pages as they are first touched. are
+// the bss pages zero and the initialized data intact whatever
+// order they are reached in, and does a program with a bss run?
+char bigbss[16*4096];
+char pagedata[] = "demand paged data";
+char *catargv[] = { "cat", "execpage", 0 };
+void
+execpagetest(void)
+{
+  int fd, fds[2], i, n, pid;
+
+  printf(stdout, "exec paging test\n");
+  for(i = sizeof(bigbss) - 1; i >= 0; i -= 4096 + 512){
+    if(bigbss[i] != 0){
+      printf(stdout, "exec paging test failed: bss not zero\n");
+      exit();
+    }
+    bigbss[i] = 1;
+  }
+  if(strcmp(pagedata, "demand paged data") != 0){
+    printf(stdout, "exec paging test failed: data\n");
+    exit();
+  }
+
+  unlink("execpage");
+  fd = open("execpage", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "paged in\n", 9) != 9){
+    printf(stdout, "exec paging test: cannot write execpage\n");
+    exit();
+  }
+  close(fd);
+  if(pipe(fds) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(1);
+    dup(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    exec("cat", catargv);
+    printf(2, "exec cat failed\n");
+    exit();
+  }
+  close(fds[1]);
+  n = 0;
+  while((i = read(fds[0], buf + n, sizeof(buf) - 1 - n)) > 0)
+    n += i;
+  close(fds[0]);
+  wait();
+  buf[n] = '\0';
+  if(strcmp(buf, "paged in\n") != 0){
+    printf(stdout, "exec paging test failed: cat wrote %d bytes\n", n);
+    exit();
+  }
+  unlink("execpage");
+
+  // our own program may not be written while we page it in;
+  // write back what is there, in case it is
+  fd = open("usertests", O_RDWR);
+  if(fd < 0 || read(fd, buf, 16) != 16){
+    printf(stdout, "exec paging test: cannot read usertests\n");
+    exit();
+  }
+  close(fd);
+  fd = open("usertests", O_RDWR);
+  if(write(fd, buf, 16) != -1){
+    printf(stdout, "exec paging test failed: wrote running program\n");
+    exit();
+  }
+  close(fd);
+  printf(stdout, "exec paging test ok\n");
+}
+
 // does exec return an error if the arguments
 // are larger than a page? or does it write
 // below the stack and wreck the instructions/data?
@@ -1765,9 +2241,12 @@ main(int argc, char *argv[])
 
   bigargtest();
   bigwrite();
+  fsynctest();
   bigargtest();
   bsstest();
+  execpagetest();
   sbrktest();
+  lazysbrktest();
   validatetest();
 
   opentest();
@@ -1781,18 +2260,22 @@ main(int argc, char *argv[])
 
   mem();
   pipe1();
+  splicetest();
   preempt();
   exitwait();
 
   rmdot();
   fourteen();
   bigfile();
+  hugefile(); // slow
   subdir();
   linktest();
   unlinkread();
   dirfile();
   iref();
   forktest();
+  cowtest();
+  cowmemtest();
   bigdir(); // slow
 
   uio();
@@ -311,39 +311,180 @@ clearpteu(pde_t *pgdir, char *uva)
 }
 
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. Writable pages are not copied but
+// shared read-only and marked PTE_COW in both page tables;
+// cowfault() copies them when either side writes.
+// pgdir must be the current page table.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
   pte_t *pte;
   uint pa, i, flags;
-  char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    // heap pages not touched yet have no page, and maybe
+    // not even a page table
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto bad;
-    memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0) {
-      kfree(mem);
+    if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
       goto bad;
-    }
+    kdup(P2V(pa));
   }
+  // the parent's writable pages just became read-only
+  lcr3(V2P(pgdir));
   return d;
 
 bad:
+  lcr3(V2P(pgdir));
   freevm(d);
   return 0;
 }
 
+// Handle a write to the copy-on-write page at va in pgdir:
+// give pgdir its own writable copy of the page, or just make
+// the page writable if nobody else shares it any more.
+// Returns 0, or -1 if va is not a copy-on-write page or
+// there is no memory for the copy.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  uint pa, flags;
+  char *mem;
+
+  if(va >= KERNBASE || (pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE_ADDR(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(krefs(P2V(pa)) == 1){
+    *pte = pa | flags;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, P2V(pa), PGSIZE);
+    *pte = V2P(mem) | flags;
+    kfree(P2V(pa));
+  }
+  invlpg((void*)va);
+  return 0;
+}
+
+// Pages read in together from an executable on a fault:
+// the one faulted on and the ones after it.
+#define READAHEAD 4
+
+// Read the page at va of segment s of p's executable into
+// memory, with up to READAHEAD-1 following pages of the
+// segment that are not there yet. Can sleep.
+// Returns 0, or -1 if the page at va could not be loaded.
+static int
+loadseg(struct proc *p, struct execseg *s, uint va)
+{
+  uint a, end, n;
+  pte_t *pte;
+  char *mem;
+
+  va = PGROUNDDOWN(va);
+  end = PGROUNDUP(s->va + s->memsz);
+  if(end > va + READAHEAD*PGSIZE)
+    end = va + READAHEAD*PGSIZE;
+
+  ilock(p->exe);
+  for(a = va; a < end; a += PGSIZE){
+    if(a != va && (pte = walkpgdir(p->pgdir, (char*)a, 0)) != 0 && (*pte & PTE_P))
+      break;
+    if((mem = kalloc()) == 0)
+      break;
+    memset(mem, 0, PGSIZE);
+    if(a < s->va + s->filesz){
+      n = s->va + s->filesz - a;
+      if(n > PGSIZE)
+        n = PGSIZE;
+      if(readi(p->exe, mem, s->off + (a - s->va), n) != n){
+        kfree(mem);
+        break;
+      }
+    }
+    if(mappages(p->pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+      kfree(mem);
+      break;
+    }
+  }
+  iunlock(p->exe);
+  return a == va ? -1 : 0;
+}
+
+// Handle a page fault at va in process p, with error code err:
+// read in a page of the executable or map a zeroed page for
+// memory below p->sz that has not been touched yet (see exec
+// and growproc), or break copy-on-write.
+// Returns 0 if p can go on, -1 if the access was bad.
+int
+pagefault(struct proc *p, uint va, uint err)
+{
+  struct execseg *s;
+  char *mem;
+
+  if(va >= p->sz)
+    return -1;
+  if(err & FEC_PR){
+    if(err & FEC_WR)
+      return cowfault(p->pgdir, va);
+    return -1;
+  }
+
+  for(s = p->execseg; s < &p->execseg[p->nexecseg]; s++)
+    if(va >= s->va && va < s->va + s->memsz)
+      return loadseg(p, s, va);
+
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(p->pgdir, (char*)PGROUNDDOWN(va), PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Make sure the pages of p from va to va+len are present, so
+// that the kernel can use them without taking a page fault that
+// has to read from disk, such as while holding a spinlock, or
+// that can fail, which in the kernel is fatal. If write is set,
+// also break copy-on-write on them, as copyout does.
+// Returns 0, or -1 if some page could not be brought in.
+int
+prefaultuvm(struct proc *p, uint va, uint len, int write)
+{
+  uint a;
+  pte_t *pte;
+
+  for(a = PGROUNDDOWN(va); a < va + len; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte == 0 || (*pte & PTE_P) == 0){
+      if(pagefault(p, a, 0) < 0)
+        return -1;
+      pte = walkpgdir(p->pgdir, (char*)a, 0);
+    }
+    if(write && (*pte & PTE_COW) && cowfault(p->pgdir, a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -352,7 +493,7 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
@@ -362,15 +503,21 @@ uva2ka(pde_t *pgdir, char *uva)
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
+// Writes through the kernel mapping, so copy-on-write pages
+// have to be broken here rather than by a page fault.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if(pte && (*pte & PTE_COW) && cowfault(pgdir, va0) < 0)
+      return -1;
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;